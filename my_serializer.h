@@ -1,227 +1,6022 @@
 #pragma once
 
 #include "tinyxml2.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <bitset>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <concepts>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <list>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <ranges>
 #include <set>
 #include <sstream>
+#include <streambuf>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MY_SERIALIZER_HAS_MMAP
+#define MY_SERIALIZER_HAS_FSYNC
+#define MY_SERIALIZER_HAS_PREAD
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define MY_SERIALIZER_HAS_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define MY_SERIALIZER_HAS_SSE42
+#include <nmmintrin.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // Simple error class
 class MyErr : public std::exception {
   const std::string info;
 
-public:
-  explicit MyErr(const std::string& s) : info(s) {}
-  const char* what() const noexcept override { return info.c_str(); }
+public:
+  explicit MyErr(const std::string& s) : info(s) {}
+  const char* what() const noexcept override { return info.c_str(); }
+};
+
+// Field access for aggregates without MY_SERIALIZE
+// The number of fields is found by brace-initializing the type with more and
+// more placeholders, and the fields are bound with a structured binding
+namespace Reflection {
+
+// Fields of a plain aggregate, the length of the tie_fields() ladder
+// MY_SERIALIZE_FIELDS has its own limit of 256 fields, use it beyond this one
+constexpr size_t max_fields = 64;
+
+// Converts to the type of any field
+struct AnyField {
+  // const& keeps converting constructors of the field types (such as the
+  // one of std::optional) preferred, instead of ambiguous
+  template <class T>
+  operator T() const&;
+};
+
+template <class T, class... Fields>
+consteval size_t field_count()
+{
+  if constexpr (sizeof...(Fields) > max_fields) {
+    return sizeof...(Fields);
+  } else if constexpr (requires { T{Fields{}..., AnyField{}}; }) {
+    return field_count<T, Fields..., AnyField>();
+  } else {
+    return sizeof...(Fields);
+  }
+}
+
+template <class T>
+struct is_std_array : std::false_type {};
+template <class T, size_t N>
+struct is_std_array<std::array<T, N>> : std::true_type {};
+
+// Plain structs. Aggregates with base classes or C array members are not
+// told apart here: the count takes a base or every array element for a
+// field, and the structured binding then fails to compile. Such types have
+// to be declared with MY_SERIALIZE or MY_SERIALIZE_FIELDS instead
+template <class T>
+concept reflectable = std::is_class_v<T> && std::is_aggregate_v<T> &&
+                      !std::is_empty_v<T> && !is_std_array<T>::value;
+
+// Fields of an aggregate with N fields, as a tuple of references
+template <size_t N, class T>
+constexpr auto tie_fields(T& data)
+{
+  if constexpr (N == 1) {
+    auto& [f1] = data;
+    return std::tie(f1);
+  } else if constexpr (N == 2) {
+    auto& [f1, f2] = data;
+    return std::tie(f1, f2);
+  } else if constexpr (N == 3) {
+    auto& [f1, f2, f3] = data;
+    return std::tie(f1, f2, f3);
+  } else if constexpr (N == 4) {
+    auto& [f1, f2, f3, f4] = data;
+    return std::tie(f1, f2, f3, f4);
+  } else if constexpr (N == 5) {
+    auto& [f1, f2, f3, f4, f5] = data;
+    return std::tie(f1, f2, f3, f4, f5);
+  } else if constexpr (N == 6) {
+    auto& [f1, f2, f3, f4, f5, f6] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6);
+  } else if constexpr (N == 7) {
+    auto& [f1, f2, f3, f4, f5, f6, f7] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7);
+  } else if constexpr (N == 8) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8);
+  } else if constexpr (N == 9) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9);
+  } else if constexpr (N == 10) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10);
+  } else if constexpr (N == 11) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11);
+  } else if constexpr (N == 12) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12);
+  } else if constexpr (N == 13) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13);
+  } else if constexpr (N == 14) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13,
+                    f14);
+  } else if constexpr (N == 15) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+           f15] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15);
+  } else if constexpr (N == 16) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16);
+  } else if constexpr (N == 17) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17);
+  } else if constexpr (N == 18) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18);
+  } else if constexpr (N == 19) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19);
+  } else if constexpr (N == 20) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20);
+  } else if constexpr (N == 21) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21);
+  } else if constexpr (N == 22) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22);
+  } else if constexpr (N == 23) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23);
+  } else if constexpr (N == 24) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24);
+  } else if constexpr (N == 25) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25);
+  } else if constexpr (N == 26) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26);
+  } else if constexpr (N == 27) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27);
+  } else if constexpr (N == 28) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27,
+           f28] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28);
+  } else if constexpr (N == 29) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28,
+           f29] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29);
+  } else if constexpr (N == 30) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30);
+  } else if constexpr (N == 31) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31);
+  } else if constexpr (N == 32) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32);
+  } else if constexpr (N == 33) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33);
+  } else if constexpr (N == 34) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34);
+  } else if constexpr (N == 35) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35);
+  } else if constexpr (N == 36) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36);
+  } else if constexpr (N == 37) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37);
+  } else if constexpr (N == 38) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38);
+  } else if constexpr (N == 39) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39);
+  } else if constexpr (N == 40) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40);
+  } else if constexpr (N == 41) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41);
+  } else if constexpr (N == 42) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41,
+           f42] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42);
+  } else if constexpr (N == 43) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42,
+           f43] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43);
+  } else if constexpr (N == 44) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44);
+  } else if constexpr (N == 45) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45);
+  } else if constexpr (N == 46) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46);
+  } else if constexpr (N == 47) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47);
+  } else if constexpr (N == 48) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48);
+  } else if constexpr (N == 49) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49);
+  } else if constexpr (N == 50) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50);
+  } else if constexpr (N == 51) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51);
+  } else if constexpr (N == 52) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52);
+  } else if constexpr (N == 53) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53);
+  } else if constexpr (N == 54) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54);
+  } else if constexpr (N == 55) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55);
+  } else if constexpr (N == 56) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55,
+           f56] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56);
+  } else if constexpr (N == 57) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56,
+           f57] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56, f57);
+  } else if constexpr (N == 58) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57,
+           f58] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56, f57, f58);
+  } else if constexpr (N == 59) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57,
+           f58, f59] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56, f57, f58, f59);
+  } else if constexpr (N == 60) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57,
+           f58, f59, f60] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56, f57, f58, f59, f60);
+  } else if constexpr (N == 61) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57,
+           f58, f59, f60, f61] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56, f57, f58, f59, f60, f61);
+  } else if constexpr (N == 62) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57,
+           f58, f59, f60, f61, f62] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56, f57, f58, f59, f60, f61, f62);
+  } else if constexpr (N == 63) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57,
+           f58, f59, f60, f61, f62, f63] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56, f57, f58, f59, f60, f61, f62,
+                    f63);
+  } else if constexpr (N == 64) {
+    auto& [f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+           f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+           f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+           f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57,
+           f58, f59, f60, f61, f62, f63, f64] = data;
+    return std::tie(f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+                    f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26,
+                    f27, f28, f29, f30, f31, f32, f33, f34, f35, f36, f37, f38,
+                    f39, f40, f41, f42, f43, f44, f45, f46, f47, f48, f49, f50,
+                    f51, f52, f53, f54, f55, f56, f57, f58, f59, f60, f61, f62,
+                    f63, f64);
+  }
+}
+
+template <class T>
+struct AggregateFields : std::false_type {};
+
+template <reflectable T>
+struct AggregateFields<T> : std::true_type {
+  static_assert(field_count<T>() <= Reflection::max_fields,
+                "Aggregate has more than Reflection::max_fields fields, list "
+                "them with MY_SERIALIZE_FIELDS");
+
+  template <class Data>
+  static constexpr auto fields(Data& data)
+  {
+    return tie_fields<field_count<T>()>(data);
+  }
+  template <class Processor, class Data>
+  static constexpr void apply(Processor& processor, Data& data)
+  {
+    std::apply([&](auto&... field) { (processor.process(field), ...); },
+               fields(data));
+  }
+};
+
+} // namespace Reflection
+
+// Field list of user-defined types, specialized by MY_SERIALIZE and
+// generated for plain aggregates
+// fields(data) returns a tuple of references to the serialized fields and
+// apply() runs processor.process() on every field in declaration order, so a
+// user-defined type can be nested in containers or in other types
+// With MY_SERIALIZE, members() also returns the pointers to those members
+template <class T>
+struct UserFields : Reflection::AggregateFields<T> {};
+
+// Format-agnostic traversal
+// Every supported type is described once here, in terms of a few primitive
+// hooks that each backend (archive) implements:
+//   loading                   true if the archive fills in the data
+//   leaf(data)                arithmetic types and strings
+//   begin_sequence(tag, len)  container of len items, returns the length
+//                             (the stored one when loading)
+//   begin_object(tag)         fixed group of items (pair, user-defined type)
+//   begin_item(name)          one item of a sequence or an object
+//   end_sequence(), end_object(), end_item()
+//   value(data)               nested data, forwards to traverse() unless the
+//                             backend has an encoding of its own for the type
+// Archives have no virtual functions, so the whole walk is inlined for each
+// of them
+namespace Traversal {
+
+template <class A>
+concept Archive = requires(A& ar, const char* tag, size_t len) {
+  { A::loading } -> std::convertible_to<bool>;
+  { ar.begin_sequence(tag, len) } -> std::convertible_to<size_t>;
+  ar.end_sequence();
+  ar.begin_object(tag);
+  ar.end_object();
+  ar.begin_item(tag);
+  ar.end_item();
+};
+
+namespace detail {
+// Matches Tmpl<...> and classes derived from it
+template <template <class...> class Tmpl, class... Args>
+std::true_type instance_test(const Tmpl<Args...>*);
+template <template <class...> class Tmpl>
+std::false_type instance_test(const void*);
+
+template <class T>
+struct is_optional : std::false_type {};
+template <class T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+// Number of optional fields in a tuple of references to fields
+template <class Tuple>
+struct optional_fields;
+template <class... F>
+struct optional_fields<std::tuple<F&...>>
+    : std::integral_constant<
+          size_t, (size_t(is_optional<std::remove_cv_t<F>>::value) + ... + 0)> {
+};
+
+// Unsigned type for the presence flags of the optional fields of T, void if
+// there are none (or too many to pack, then each has its own flag)
+template <class T>
+constexpr auto presence_mask()
+{
+  using Fields = decltype(UserFields<T>::fields(std::declval<T&>()));
+  constexpr size_t n = optional_fields<Fields>::value;
+  if constexpr (n == 0 || n > 64) {
+    return std::type_identity<void>();
+  } else if constexpr (n <= 8) {
+    return std::type_identity<uint8_t>();
+  } else if constexpr (n <= 16) {
+    return std::type_identity<uint16_t>();
+  } else if constexpr (n <= 32) {
+    return std::type_identity<uint32_t>();
+  } else {
+    return std::type_identity<uint64_t>();
+  }
+}
+template <class T>
+using presence_mask_t = typename decltype(presence_mask<T>())::type;
+
+template <class T>
+struct is_bitset : std::false_type {};
+template <size_t N>
+struct is_bitset<std::bitset<N>> : std::true_type {};
+} // namespace detail
+
+// Concepts below accept const data (saving) as well as mutable (loading)
+template <class T, template <class...> class Tmpl>
+concept instance_of = decltype(detail::instance_test<Tmpl>(
+    std::declval<std::remove_cv_t<T>*>()))::value;
+
+// Strings with any allocator (std::string, std::pmr::string...)
+template <class T>
+concept string_type =
+    instance_of<T, std::basic_string> &&
+    std::is_same_v<typename std::remove_cv_t<T>::traits_type,
+                   std::char_traits<char>>;
+
+template <class T>
+concept leaf_type = std::is_arithmetic_v<std::remove_cv_t<T>> ||
+                    string_type<T> ||
+                    std::is_same_v<std::remove_cv_t<T>, std::string_view>;
+
+template <class T>
+concept user_type = UserFields<std::remove_cv_t<T>>::value;
+
+// User-defined types with member pointers, from MY_SERIALIZE
+template <class T>
+concept has_members = user_type<T> && requires {
+  UserFields<std::remove_cv_t<T>>::members();
+};
+
+namespace detail {
+template <class T>
+struct is_array : std::false_type {};
+template <class T, size_t N>
+struct is_array<std::array<T, N>> : std::true_type {};
+} // namespace detail
+
+// Fixed extent: std::array, stored without a length
+template <class T>
+concept array_type = detail::is_array<std::remove_cv_t<T>>::value;
+
+// Any sized range with a value type that is not a leaf or an array
+template <class T>
+concept sized_range = !leaf_type<T> && !user_type<T> && !array_type<T> &&
+                      requires(T& data) {
+                        typename T::value_type;
+                        std::ranges::begin(data);
+                        std::ranges::end(data);
+                        data.size();
+                      };
+
+// Associative containers (set, map, unordered and multi- variants)
+template <class T>
+concept associative = sized_range<T> && requires { typename T::key_type; };
+
+// Sequences that can be sized up front for loading (vector, list, deque...)
+template <class T>
+concept sequence = sized_range<T> && !associative<T> &&
+                   requires(std::remove_cv_t<T>& data, size_t len) {
+                     data.resize(len);
+                   };
+
+// Objects behind shared pointers, numbered from 1 in the order they are
+// first met, so that each one is written once (see Describe)
+// Every archive owns one, returned by its shared_objects() hook
+struct SharedObjects {
+  std::unordered_map<const void*, uint32_t> ids; // Saving: address -> id
+  std::vector<std::shared_ptr<void>> objects;    // Loading: id - 1 -> object
+};
+
+// Registry of the types stored behind pointers to a polymorphic Base, filled
+// by MY_SERIALIZE_DERIVED
+// Every type has a small fixed id, written before the object; objects are
+// created and processed through tables indexed by that id
+// The dynamic type of an object is looked up by the address of its
+// type_info, names are only compared for types not found that way
+template <class Base>
+class Polymorphic {
+  // Reference to an object as passed by archive A
+  template <class A, class T = Base>
+  using Ref = std::conditional_t<A::loading, T&, const T&>;
+
+public:
+  static constexpr uint32_t unregistered = UINT32_MAX;
+
+  // Id of Derived, unregistered until add<Derived>() is called
+  template <class Derived>
+  static uint32_t id_of()
+  {
+    return derived_id<Derived>;
+  }
+  // Id of the dynamic type of object
+  static uint32_t id_of(const Base& object)
+  {
+    const std::type_info* type = &typeid(object);
+    const Registry& types = registry();
+    auto it = types.ids.find(type);
+    if (it != types.ids.end()) {
+      return it->second;
+    }
+    // The same type may have several type_info objects across shared
+    // libraries
+    for (const auto& [info, id] : types.ids) {
+      if (*info == *type) {
+        return id;
+      }
+    }
+    throw MyErr("Traversal: Polymorphic type not registered");
+  }
+  // New default-constructed object of type id
+  static Base* create(uint32_t id)
+  {
+    const Registry& types = registry();
+    if (id >= types.create.size() || !types.create[id]) {
+      throw MyErr("Traversal: Unknown polymorphic type id");
+    }
+    return types.create[id]();
+  }
+  // Process object as its type id
+  template <class A>
+  static void process(A& ar, Ref<A> object, uint32_t id)
+  {
+    const auto& table = jump_table<A>();
+    if (id >= table.size() || !table[id]) {
+      throw MyErr("Traversal: Unknown polymorphic type id");
+    }
+    table[id](ar, object);
+  }
+
+  // Registers Derived as id for every archive, see MY_SERIALIZE_DERIVED
+  // Registering the same pair again does nothing (the macro runs once per
+  // translation unit); throws MyErr if the id or the type is already taken
+  // by another registration
+  template <class Derived>
+  static bool add(uint32_t id);
+
+private:
+  struct Registry {
+    std::unordered_map<const std::type_info*, uint32_t> ids;
+    std::vector<Base* (*)()> create; // By id
+  };
+  template <class Derived>
+  static inline uint32_t derived_id = unregistered;
+  static Registry& registry()
+  {
+    static Registry types;
+    return types;
+  }
+  template <class A>
+  static std::vector<void (*)(A&, Ref<A>)>& jump_table()
+  {
+    static std::vector<void (*)(A&, Ref<A>)> table; // By id
+    return table;
+  }
+  template <class Derived, class A>
+  static void add_to(uint32_t id)
+  {
+    auto& table = jump_table<A>();
+    if (table.size() <= id) {
+      table.resize(id + 1);
+    }
+    table[id] = [](A& ar, Ref<A> object) {
+      ar.value(static_cast<Ref<A, Derived>>(object));
+    };
+  }
+};
+
+// Static members, so that the overloads see each other in any order
+struct Describe {
+  // Arithmetic types & string, left to the archive
+  template <class A, leaf_type T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    ar.leaf(data);
+  }
+  // User-defined types declared by MY_SERIALIZE: one item per field
+  // Presence flags of all optional fields come first, packed into the
+  // smallest unsigned type with enough bits, and absent fields are skipped
+  template <class A, user_type T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    using Mask = detail::presence_mask_t<std::remove_cv_t<T>>;
+    ar.begin_object("object");
+    Fields<A, Mask> fields{ar};
+    if constexpr (!std::is_void_v<Mask>) {
+      if constexpr (!A::loading) {
+        Presence<Mask> presence;
+        UserFields<std::remove_cv_t<T>>::apply(presence, data);
+        fields.mask = presence.mask;
+      }
+      item(ar, "present", fields.mask);
+    }
+    UserFields<std::remove_cv_t<T>>::apply(fields, data);
+    ar.end_object();
+  }
+  // Bitset, as a string of 0 and 1 (highest bit first)
+  template <class A, class T>
+    requires detail::is_bitset<std::remove_cv_t<T>>::value
+  static constexpr void apply(A& ar, T& data)
+  {
+    if constexpr (A::loading) {
+      std::string bits;
+      ar.leaf(bits);
+      data = std::remove_cv_t<T>(bits);
+    } else {
+      std::string bits = data.to_string();
+      ar.leaf(bits);
+    }
+  }
+
+  // STL containers
+  // Pair
+  template <class A, instance_of<std::pair> T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    ar.begin_object("pair");
+    item(ar, "first", data.first);
+    item(ar, "second", data.second);
+    ar.end_object();
+  }
+  // Unique pointer: presence flag, then the object
+  template <class A, instance_of<std::unique_ptr> T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    ar.begin_object("unique_ptr");
+    bool present = data != nullptr;
+    item(ar, "present", present);
+    if (present) {
+      pointee(ar, data.get(), [&](auto* object) { data.reset(object); });
+    } else if constexpr (A::loading) {
+      data.reset();
+    }
+    ar.end_object();
+  }
+  // Shared pointer: id of the object (0 for null), the object itself only
+  // follows its first id, so shared objects are written once and loaded
+  // into a single object again
+  // An object is registered before its contents, cycles end up as ids too
+  template <class A, instance_of<std::shared_ptr> T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    SharedObjects& shared = ar.shared_objects();
+    ar.begin_object("shared_ptr");
+    if constexpr (A::loading) {
+      using E = typename T::element_type;
+      uint32_t id;
+      item(ar, "id", id);
+      if (id == 0) {
+        data.reset();
+      } else if (id <= shared.objects.size()) {
+        data = std::static_pointer_cast<E>(shared.objects[id - 1]);
+      } else if (id == shared.objects.size() + 1) {
+        pointee(ar, static_cast<E*>(nullptr), [&](auto* object) {
+          data.reset(object);
+          shared.objects.push_back(data);
+        });
+      } else {
+        throw MyErr("Traversal: Corrupted shared object id");
+      }
+    } else {
+      uint32_t id = 0;
+      bool first = false;
+      if (data) {
+        auto [it, inserted] = shared.ids.try_emplace(
+            data.get(), static_cast<uint32_t>(shared.ids.size() + 1));
+        id = it->second;
+        first = inserted;
+      }
+      item(ar, "id", id);
+      if (first) {
+        pointee(ar, data.get(), [](auto*) {});
+      }
+    }
+    ar.end_object();
+  }
+  // Optional: presence flag, then the value
+  template <class A, instance_of<std::optional> T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    ar.begin_object("optional");
+    bool present = data.has_value();
+    item(ar, "present", present);
+    if constexpr (A::loading) {
+      if (!present) {
+        data.reset();
+      } else if (!data) {
+        data.emplace();
+      }
+    }
+    if (present) {
+      item(ar, "item", *data);
+    }
+    ar.end_object();
+  }
+  // Variant: index of the alternative in the smallest type that holds all
+  // of them, then the alternative itself
+  template <class A, instance_of<std::variant> T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    using V = std::remove_cv_t<T>;
+    constexpr size_t count = std::variant_size_v<V>;
+    using Index = std::conditional_t<(count <= UINT8_MAX), uint8_t, uint16_t>;
+    ar.begin_object("variant");
+    if constexpr (!A::loading) {
+      if (data.valueless_by_exception()) {
+        throw MyErr("Traversal: Variant without a value");
+      }
+    }
+    Index index = static_cast<Index>(data.index());
+    item(ar, "index", index);
+    if (index >= count) {
+      throw MyErr("Traversal: Corrupted variant index");
+    }
+    alternative(ar, data, index, std::make_index_sequence<count>());
+    ar.end_object();
+  }
+  // Tuple, an item per element
+  template <class A, instance_of<std::tuple> T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    ar.begin_object("tuple");
+    std::apply([&](auto&... value) { (item(ar, "item", value), ...); }, data);
+    ar.end_object();
+  }
+  // Fixed extent (std::array, C array): the items without a length
+  template <class A, array_type T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    ar.begin_object("array");
+    for (auto& value : data) {
+      item(ar, "item", value);
+    }
+    ar.end_object();
+  }
+  template <class A, class T, size_t N>
+  static constexpr void apply(A& ar, T (&data)[N])
+  {
+    ar.begin_object("array");
+    for (auto& value : data) {
+      item(ar, "item", value);
+    }
+    ar.end_object();
+  }
+  // Sequences (vector, list, deque...), loaded in place after one resize
+  template <class A, sequence T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    size_t len = ar.begin_sequence(sequence_tag<T>(), data.size());
+    if constexpr (A::loading) {
+      data.clear();
+      data.resize(len);
+    }
+    if constexpr (instance_of<T, std::vector> &&
+                  std::is_same_v<typename T::value_type, bool>) {
+      for (size_t i = 0; i < len; i++) { // No references into vector<bool>
+        bool flag = data[i];
+        item(ar, "item", flag);
+        if constexpr (A::loading) {
+          data[i] = flag;
+        }
+      }
+    } else {
+      for (auto& value : data) {
+        item(ar, "item", value);
+      }
+    }
+    ar.end_sequence();
+  }
+  // Associative containers, every item of a map holds a key and a value
+  // Loading presizes hash tables once and appends to ordered ones in O(1),
+  // since items are stored in container order
+  template <class A, associative T>
+  static constexpr void apply(A& ar, T& data)
+  {
+    constexpr bool is_map = requires { typename T::mapped_type; };
+    size_t len = ar.begin_sequence(is_map ? "map" : "set", data.size());
+    if constexpr (A::loading) {
+      data.clear();
+      if constexpr (requires { data.reserve(len); }) {
+        data.reserve(len); // Buckets for len items, no rehash on the way
+      }
+      for (size_t i = 0; i < len; i++) {
+        if constexpr (is_map) {
+          auto key = make<typename T::key_type>(data);
+          auto value = make<typename T::mapped_type>(data);
+          ar.begin_item("item");
+          item(ar, "key", key);
+          item(ar, "value", value);
+          ar.end_item();
+          insert(data, std::move(key), std::move(value));
+        } else {
+          auto value = make<typename T::value_type>(data);
+          item(ar, "item", value);
+          insert(data, std::move(value));
+        }
+      }
+    } else {
+      for (const auto& value : data) {
+        if constexpr (is_map) {
+          ar.begin_item("item");
+          item(ar, "key", value.first);
+          item(ar, "value", value.second);
+          ar.end_item();
+        } else {
+          item(ar, "item", value);
+        }
+      }
+    }
+    ar.end_sequence();
+  }
+
+  // Element to be loaded and moved into data, allocated like data's own
+  // elements so that moving it in is not a copy (std::pmr containers...)
+  template <class V, class C>
+  static constexpr V make(C& data)
+  {
+    if constexpr (requires { data.get_allocator(); }) {
+      return std::make_obj_using_allocator<V>(data.get_allocator());
+    } else {
+      return V();
+    }
+  }
+
+private:
+  // Alternative index of data, through a table indexed by alternative
+  template <class A, class T, size_t... I>
+  static constexpr void alternative(A& ar, T& data, size_t index,
+                                    std::index_sequence<I...>)
+  {
+    using Visit = void (*)(A&, T&);
+    constexpr Visit table[] = {[](A& ar, T& data) {
+      if constexpr (A::loading) {
+        if (data.index() != I) {
+          data.template emplace<I>();
+        }
+      }
+      item(ar, "item", std::get<I>(data));
+    }...};
+    table[index](ar, data);
+  }
+
+  // Object behind a pointer, preceded by its type id if E is polymorphic
+  // When loading, objects that have to be created are passed to adopt()
+  // before their contents are loaded
+  template <class A, class E, class Adopt>
+  static constexpr void pointee(A& ar, E* object, Adopt adopt)
+  {
+    if constexpr (std::is_polymorphic_v<E>) {
+      using Types = Polymorphic<std::remove_cv_t<E>>;
+      uint32_t type = 0;
+      if constexpr (!A::loading) {
+        type = Types::id_of(*object);
+      }
+      item(ar, "type", type);
+      if constexpr (A::loading) {
+        object = Types::create(type); // Always the stored type
+        adopt(object);
+      }
+      ar.begin_item("item");
+      Types::process(ar, *object, type);
+      ar.end_item();
+    } else {
+      if constexpr (A::loading) {
+        if (!object) {
+          object = new E();
+          adopt(object);
+        }
+      }
+      item(ar, "item", *object);
+    }
+  }
+
+  // Node names of the common sequences, so that XML files stay readable
+  template <class T>
+  static constexpr const char* sequence_tag()
+  {
+    if constexpr (instance_of<T, std::vector>) {
+      return "vector";
+    } else if constexpr (instance_of<T, std::list>) {
+      return "list";
+    } else if constexpr (instance_of<T, std::deque>) {
+      return "deque";
+    } else {
+      return "sequence";
+    }
+  }
+
+  template <class C, class... Args>
+  static constexpr void insert(C& data, Args&&... args)
+  {
+    if constexpr (requires { data.key_comp(); }) {
+      data.emplace_hint(data.end(), std::forward<Args>(args)...);
+    } else {
+      data.emplace(std::forward<Args>(args)...);
+    }
+  }
+
+  template <class A, class T>
+  static constexpr void item(A& ar, const char* name, T& data)
+  {
+    ar.begin_item(name);
+    ar.value(data);
+    ar.end_item();
+  }
+
+  // Processor for UserFields<T>::apply()
+  // Optional fields take their presence from mask, unless Mask is void
+  template <class A, class Mask>
+  struct Fields {
+    A& ar;
+    std::conditional_t<std::is_void_v<Mask>, bool, Mask> mask = 0;
+    unsigned bit = 0;
+    template <class F>
+    constexpr void process(F& field)
+    {
+      if constexpr (!std::is_void_v<Mask> &&
+                    instance_of<F, std::optional>) {
+        bool present = (mask >> bit++) & 1;
+        if constexpr (A::loading) {
+          if (!present) {
+            field.reset();
+            return;
+          }
+          if (!field) {
+            field.emplace();
+          }
+        }
+        if (present) {
+          item(ar, "field", *field);
+        }
+      } else {
+        item(ar, "field", field);
+      }
+    }
+  };
+  // Collects the presence flags of optional fields
+  template <class Mask>
+  struct Presence {
+    Mask mask = 0;
+    unsigned bit = 0;
+    template <class F>
+    constexpr void process(F& field)
+    {
+      if constexpr (instance_of<F, std::optional>) {
+        mask |= Mask(field.has_value()) << bit++;
+      }
+    }
+  };
+};
+
+// Walk data with archive ar
+template <Archive A, class T>
+constexpr void traverse(A& ar, T& data)
+{
+  Describe::apply(ar, data);
+}
+
+} // namespace Traversal
+
+// Durable file replacement: data goes to a temporary file next to the
+// target, is synced, then renamed over the target, and the directory entry is
+// synced. A crash leaves either the old or the new file, never a mix
+// Without POSIX the syncs are skipped and only the rename remains
+namespace FileIO {
+
+inline std::string temp_name(const std::string& file_name)
+{
+  return file_name + ".tmp";
+}
+
+// Sidecar of a file saved with BinaryOptions::skip_unchanged, see Fingerprint
+inline std::string fingerprint_name(const std::string& file_name)
+{
+  return file_name + ".hash";
+}
+
+// Every write of a file goes through here first: its content is about to
+// change, so a fingerprint must no longer vouch for it
+// Files written outside this library have to call it as well
+inline void drop_fingerprint(const std::string& file_name)
+{
+  std::remove(fingerprint_name(file_name).c_str());
+}
+
+namespace detail {
+
+inline std::string directory_of(const std::string& file_name)
+{
+  size_t slash = file_name.find_last_of('/');
+  if (slash == std::string::npos) {
+    return ".";
+  }
+  return slash == 0 ? "/" : file_name.substr(0, slash);
+}
+
+// Flush a file (or directory) to the disk
+inline void sync(const std::string& path, bool directory = false)
+{
+#ifdef MY_SERIALIZER_HAS_FSYNC
+  int fd = ::open(path.c_str(), directory ? O_RDONLY : O_WRONLY);
+  if (fd < 0) {
+    throw MyErr("FileIO: Cannot open " + path);
+  }
+  int res = ::fsync(fd);
+  ::close(fd);
+  // Some file systems cannot sync directories, the rename still holds
+  if (res != 0 && !(directory && (errno == EINVAL || errno == EBADF))) {
+    throw MyErr("FileIO: Cannot sync " + path);
+  }
+#else
+  (void)path;
+  (void)directory;
+#endif
+}
+
+// Start writing a file back without waiting, so the syncs of a batch overlap
+inline void start_writeback(const std::string& path)
+{
+#ifdef __linux__
+  int fd = ::open(path.c_str(), O_WRONLY);
+  if (fd >= 0) {
+    ::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    ::close(fd);
+  }
+#else
+  (void)path;
+#endif
+}
+
+inline void rename(const std::string& from, const std::string& to)
+{
+#ifndef MY_SERIALIZER_HAS_FSYNC
+  std::remove(to.c_str()); // Only POSIX rename replaces the target
+#endif
+  if (std::rename(from.c_str(), to.c_str()) != 0) {
+    throw MyErr("FileIO: Cannot rename " + from + " to " + to);
+  }
+}
+
+} // namespace detail
+
+// Group commit: files staged together are made durable together
+// All temporary files are synced first (their writeback overlaps), then
+// renamed, then every directory involved is synced once
+//   SaveBatch batch;
+//   serialize(a, batch.stage("a.data"));
+//   serialize_xml(b, batch.stage("b.xml"));
+//   batch.commit();
+// Staged files that are never committed are removed
+class SaveBatch {
+public:
+  SaveBatch() = default;
+  SaveBatch(const SaveBatch&) = delete;
+  SaveBatch& operator=(const SaveBatch&) = delete;
+  ~SaveBatch()
+  {
+    for (const std::string& file_name : files) {
+      std::remove(temp_name(file_name).c_str());
+    }
+  }
+
+  // Name to write the new content of file_name to
+  std::string stage(const std::string& file_name)
+  {
+    files.push_back(file_name);
+    return temp_name(file_name);
+  }
+
+  void commit()
+  {
+    for (const std::string& file_name : files) {
+      detail::start_writeback(temp_name(file_name));
+    }
+    for (const std::string& file_name : files) {
+      detail::sync(temp_name(file_name));
+    }
+    for (const std::string& file_name : files) {
+      drop_fingerprint(file_name);
+    }
+    std::set<std::string> directories;
+    for (const std::string& file_name : files) {
+      detail::rename(temp_name(file_name), file_name);
+      directories.insert(detail::directory_of(file_name));
+    }
+    files.clear();
+    for (const std::string& directory : directories) {
+      detail::sync(directory, true);
+    }
+  }
+
+private:
+  std::vector<std::string> files;
+};
+
+} // namespace FileIO
+
+namespace BinarySerialize {
+
+// CRC32C (Castagnoli), used to check framed binary archives
+// Uses the SSE4.2 crc32 instruction when the CPU has it, otherwise a
+// slicing-by-8 table lookup
+namespace detail {
+
+struct Crc32cTable {
+  uint32_t t[8][256];
+  constexpr Crc32cTable() : t()
+  {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int k = 0; k < 8; k++) {
+        crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+      }
+      t[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int k = 1; k < 8; k++) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+      }
+    }
+  }
+};
+
+inline uint32_t crc32c_soft(uint32_t crc, const char* data, size_t len)
+{
+  static constexpr Crc32cTable table;
+  const auto& t = table.t;
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  crc = ~crc;
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    word ^= crc; // Little endian: low bytes are the first ones
+    crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^
+          t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+          t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^
+          t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+  }
+  while (len--) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  }
+  return ~crc;
+}
+
+#ifdef MY_SERIALIZER_HAS_SSE42
+__attribute__((target("sse4.2"))) inline uint32_t
+crc32c_hw(uint32_t crc, const char* data, size_t len)
+{
+  crc = ~crc;
+#ifdef __x86_64__
+  uint64_t crc64 = crc;
+  for (; len >= 8; len -= 8, data += 8) {
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  for (; len >= 4; len -= 4, data += 4) {
+    uint32_t word;
+    std::memcpy(&word, data, 4);
+    crc = _mm_crc32_u32(crc, word);
+  }
+  while (len--) {
+    crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data++));
+  }
+  return ~crc;
+}
+#endif
+
+// Frame-of-reference bit packing of integer blocks
+// A block holds 128 offsets below 2^width (width <= 32) in 4 * width words.
+// Offset i lives in lane i % 4 and every lane is a bit stream spread over
+// words lane, lane + 4, lane + 8..., so SSE2 unpacks 4 offsets at a time
+constexpr size_t pack_block = 128;
+
+inline void pack128_soft(const uint32_t* in, unsigned width, uint32_t* out)
+{
+  std::fill(out, out + 4 * width, 0u);
+  for (size_t i = 0; i < pack_block; i++) {
+    size_t lane = i % 4;
+    size_t bit = (i / 4) * width;
+    size_t word = bit / 32, shift = bit % 32;
+    uint64_t v = uint64_t(in[i]) << shift;
+    out[word * 4 + lane] |= static_cast<uint32_t>(v);
+    if (shift + width > 32) {
+      out[(word + 1) * 4 + lane] |= static_cast<uint32_t>(v >> 32);
+    }
+  }
+}
+
+inline void unpack128_soft(const uint32_t* in, unsigned width, uint32_t* out)
+{
+  uint32_t mask = width == 32 ? ~0u : (1u << width) - 1;
+  for (size_t j = 0; j < pack_block / 4; j++) {
+    size_t bit = j * width;
+    size_t word = bit / 32, shift = bit % 32;
+    for (size_t lane = 0; lane < 4; lane++) {
+      uint64_t v = in[word * 4 + lane] >> shift;
+      if (shift + width > 32) {
+        v |= uint64_t(in[(word + 1) * 4 + lane]) << (32 - shift);
+      }
+      out[j * 4 + lane] = static_cast<uint32_t>(v) & mask;
+    }
+  }
+}
+
+#ifdef __SSE2__
+inline void pack128_sse2(const uint32_t* in, unsigned width, uint32_t* out)
+{
+  const __m128i* src = reinterpret_cast<const __m128i*>(in);
+  __m128i* dst = reinterpret_cast<__m128i*>(out);
+  __m128i acc = _mm_setzero_si128();
+  for (size_t j = 0; j < pack_block / 4; j++) {
+    size_t bit = j * width;
+    size_t word = bit / 32, shift = bit % 32;
+    __m128i v = _mm_loadu_si128(src + j);
+    acc = _mm_or_si128(
+        acc, _mm_sll_epi32(v, _mm_cvtsi32_si128(static_cast<int>(shift))));
+    if (shift + width >= 32) { // Word complete, carry the rest over
+      _mm_storeu_si128(dst + word, acc);
+      acc = _mm_srl_epi32(v,
+                          _mm_cvtsi32_si128(static_cast<int>(32 - shift)));
+    }
+  }
+}
+
+inline void unpack128_sse2(const uint32_t* in, unsigned width, uint32_t* out)
+{
+  const __m128i* src = reinterpret_cast<const __m128i*>(in);
+  __m128i* dst = reinterpret_cast<__m128i*>(out);
+  const __m128i mask =
+      _mm_set1_epi32(static_cast<int>(width == 32 ? ~0u : (1u << width) - 1));
+  for (size_t j = 0; j < pack_block / 4; j++) {
+    size_t bit = j * width;
+    size_t word = bit / 32, shift = bit % 32;
+    __m128i v = _mm_srl_epi32(_mm_loadu_si128(src + word),
+                              _mm_cvtsi32_si128(static_cast<int>(shift)));
+    if (shift + width > 32) {
+      __m128i hi = _mm_sll_epi32(
+          _mm_loadu_si128(src + word + 1),
+          _mm_cvtsi32_si128(static_cast<int>(32 - shift)));
+      v = _mm_or_si128(v, hi);
+    }
+    _mm_storeu_si128(dst + j, _mm_and_si128(v, mask));
+  }
+}
+#endif
+
+// Offsets must be below 2^width
+inline void pack128(const uint32_t* in, unsigned width, uint32_t* out)
+{
+  if (width == 0) {
+    return;
+  }
+#ifdef __SSE2__
+  pack128_sse2(in, width, out);
+#else
+  pack128_soft(in, width, out);
+#endif
+}
+
+inline void unpack128(const uint32_t* in, unsigned width, uint32_t* out)
+{
+  if (width == 0) {
+    std::fill(out, out + pack_block, 0u);
+    return;
+  }
+#ifdef __SSE2__
+  unpack128_sse2(in, width, out);
+#else
+  unpack128_soft(in, width, out);
+#endif
+}
+
+// MSB-first bit stream used by the float codec
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<char>& out) : out(out) {}
+
+  // Append the low bits of value, bits <= 64
+  void put(uint64_t value, unsigned bits)
+  {
+    if (bits > 32) {
+      put(value >> 32, bits - 32);
+      bits = 32;
+    }
+    value &= (uint64_t(1) << bits) - 1;
+    acc = (acc << bits) | value;
+    cnt += bits;
+    while (cnt >= 8) {
+      cnt -= 8;
+      out.push_back(static_cast<char>(acc >> cnt));
+    }
+  }
+  // Pad the last byte with zeros
+  void finish()
+  {
+    if (cnt > 0) {
+      out.push_back(static_cast<char>(acc << (8 - cnt)));
+      cnt = 0;
+    }
+  }
+
+private:
+  std::vector<char>& out;
+  uint64_t acc = 0; // Pending bits are the low cnt bits
+  unsigned cnt = 0;
+};
+
+class BitReader {
+public:
+  BitReader(const char* data, size_t len)
+      : p(reinterpret_cast<const unsigned char*>(data)), end(p + len)
+  {
+  }
+
+  // Next bits of the stream, bits <= 64
+  uint64_t get(unsigned bits)
+  {
+    if (bits > 32) {
+      uint64_t high = get(bits - 32);
+      return (high << 32) | get(32);
+    }
+    while (cnt < bits) {
+      if (p == end) {
+        throw MyErr("BitReader: Unexpected end of data");
+      }
+      acc = (acc << 8) | *p++;
+      cnt += 8;
+    }
+    cnt -= bits;
+    return (acc >> cnt) & ((uint64_t(1) << bits) - 1);
+  }
+
+private:
+  const unsigned char* p;
+  const unsigned char* end;
+  uint64_t acc = 0;
+  unsigned cnt = 0;
+};
+
+// XOR float compression from Facebook's Gorilla paper
+// First value as is, then per value the XOR with its predecessor:
+//   0                    same value
+//   10 bits              meaningful bits inside the previous window
+//   11 lead(5) len-1(6)  new window, then its len meaningful bits
+template <class F>
+void gorilla_encode(const F* data, size_t len, std::vector<char>& out)
+{
+  using Bits = std::conditional_t<sizeof(F) == 8, uint64_t, uint32_t>;
+  constexpr unsigned width = 8 * sizeof(F);
+  BitWriter writer(out);
+  if (len == 0) {
+    return;
+  }
+  Bits prev = std::bit_cast<Bits>(data[0]);
+  writer.put(prev, width);
+  unsigned lead = width + 1, trail = 0; // No window yet
+  for (size_t i = 1; i < len; i++) {
+    Bits cur = std::bit_cast<Bits>(data[i]);
+    Bits x = cur ^ prev;
+    prev = cur;
+    if (x == 0) {
+      writer.put(0, 1);
+      continue;
+    }
+    unsigned new_lead = std::min(std::countl_zero(x), 31);
+    unsigned new_trail = std::countr_zero(x);
+    if (lead <= width && new_lead >= lead && new_trail >= trail) {
+      writer.put(0b10, 2);
+      writer.put(x >> trail, width - lead - trail);
+    } else {
+      lead = new_lead;
+      trail = new_trail;
+      unsigned sig = width - lead - trail;
+      writer.put(0b11, 2);
+      writer.put(lead, 5);
+      writer.put(sig - 1, 6);
+      writer.put(x >> trail, sig);
+    }
+  }
+  writer.finish();
+}
+
+template <class F>
+void gorilla_decode(const char* src, size_t src_len, F* data, size_t len)
+{
+  using Bits = std::conditional_t<sizeof(F) == 8, uint64_t, uint32_t>;
+  constexpr unsigned width = 8 * sizeof(F);
+  BitReader reader(src, src_len);
+  if (len == 0) {
+    return;
+  }
+  Bits prev = static_cast<Bits>(reader.get(width));
+  data[0] = std::bit_cast<F>(prev);
+  unsigned lead = width + 1, trail = 0;
+  for (size_t i = 1; i < len; i++) {
+    if (reader.get(1)) {
+      if (reader.get(1)) {
+        lead = static_cast<unsigned>(reader.get(5));
+        unsigned sig = static_cast<unsigned>(reader.get(6)) + 1;
+        if (lead + sig > width) {
+          throw MyErr("gorilla_decode: Corrupted data");
+        }
+        trail = width - lead - sig;
+      } else if (lead > width) {
+        throw MyErr("gorilla_decode: Corrupted data");
+      }
+      prev ^= static_cast<Bits>(reader.get(width - lead - trail) << trail);
+    }
+    data[i] = std::bit_cast<F>(prev);
+  }
+}
+
+} // namespace detail
+
+// Continue crc over [data, data + len), start with crc = 0
+inline uint32_t crc32c(uint32_t crc, const char* data, size_t len)
+{
+#ifdef MY_SERIALIZER_HAS_SSE42
+  static const bool hw = __builtin_cpu_supports("sse4.2");
+  if (hw) {
+    return detail::crc32c_hw(crc, data, len);
+  }
+#endif
+  return detail::crc32c_soft(crc, data, len);
+}
+
+// Streaming 64-bit content hash (XXH64), for fingerprints of whole files
+class ContentHash {
+public:
+  explicit ContentHash(uint64_t seed = 0)
+      : acc{seed + p1 + p2, seed + p2, seed, seed - p1}, seed(seed)
+  {
+  }
+
+  void update(const char* data, size_t len)
+  {
+    total += len;
+    if (used + len < 32) {
+      std::memcpy(tail + used, data, len);
+      used += len;
+      return;
+    }
+    if (used > 0) {
+      size_t fill = 32 - used;
+      std::memcpy(tail + used, data, fill);
+      stripe(tail);
+      data += fill;
+      len -= fill;
+      used = 0;
+    }
+    for (; len >= 32; data += 32, len -= 32) {
+      stripe(data);
+    }
+    std::memcpy(tail, data, len);
+    used = len;
+  }
+
+  uint64_t digest() const
+  {
+    uint64_t h;
+    if (total >= 32) {
+      h = std::rotl(acc[0], 1) + std::rotl(acc[1], 7) +
+          std::rotl(acc[2], 12) + std::rotl(acc[3], 18);
+      for (uint64_t v : acc) {
+        h = (h ^ round(0, v)) * p1 + p4;
+      }
+    } else {
+      h = seed + p5;
+    }
+    h += total;
+    size_t i = 0;
+    for (; i + 8 <= used; i += 8) {
+      h = std::rotl(h ^ round(0, load<uint64_t>(tail + i)), 27) * p1 + p4;
+    }
+    if (i + 4 <= used) {
+      h = std::rotl(h ^ (load<uint32_t>(tail + i) * p1), 23) * p2 + p3;
+      i += 4;
+    }
+    for (; i < used; i++) {
+      h = std::rotl(h ^ (uint8_t(tail[i]) * p5), 11) * p1;
+    }
+    h = (h ^ (h >> 33)) * p2;
+    h = (h ^ (h >> 29)) * p3;
+    return h ^ (h >> 32);
+  }
+
+private:
+  static constexpr uint64_t p1 = 0x9e3779b185ebca87;
+  static constexpr uint64_t p2 = 0xc2b2ae3d27d4eb4f;
+  static constexpr uint64_t p3 = 0x165667b19e3779f9;
+  static constexpr uint64_t p4 = 0x85ebca77c2b2ae63;
+  static constexpr uint64_t p5 = 0x27d4eb2f165667c5;
+
+  template <class U>
+  static U load(const char* p)
+  {
+    U v;
+    std::memcpy(&v, p, sizeof(v)); // Host byte order, like the files
+    return v;
+  }
+  static uint64_t round(uint64_t acc, uint64_t input)
+  {
+    return std::rotl(acc + input * p2, 31) * p1;
+  }
+  void stripe(const char* p)
+  {
+    for (int i = 0; i < 4; i++) {
+      acc[i] = round(acc[i], load<uint64_t>(p + 8 * i));
+    }
+  }
+
+  uint64_t acc[4];
+  uint64_t seed;
+  uint64_t total = 0;
+  char tail[32];
+  size_t used = 0;
+};
+
+// Output stage hashing the bytes on their way to the sink, or only hashing
+// them without a sink (BinaryOptions::skip_unchanged)
+// Bytes are hashed a block at a time, right before the block is handed on
+class HashWriter : public std::streambuf {
+public:
+  explicit HashWriter(std::streambuf* sink = nullptr,
+                      size_t block_size = 1 << 16)
+      : sink(sink), block(block_size)
+  {
+    setp(block.data(), block.data() + block.size());
+  }
+
+  // Flush the pending block, called once before digest()
+  void finish()
+  {
+    flush_block();
+    if (sink)
+      sink->pubsync();
+  }
+  uint64_t digest() const { return hash.digest(); }
+  uint64_t count() const { return cnt; }
+
+protected:
+  int_type overflow(int_type ch) override
+  {
+    flush_block();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+  int sync() override
+  {
+    flush_block();
+    return sink ? sink->pubsync() : 0;
+  }
+
+private:
+  void flush_block()
+  {
+    size_t len = pptr() - pbase();
+    if (len == 0) {
+      return;
+    }
+    hash.update(pbase(), len);
+    cnt += len;
+    if (sink)
+      sink->sputn(pbase(), len);
+    setp(block.data(), block.data() + block.size());
+  }
+
+  std::streambuf* sink;
+  std::vector<char> block;
+  ContentHash hash;
+  uint64_t cnt = 0;
+};
+
+// Framed format: [header][chunk]...[end chunk]
+// Header: magic, version, maximal chunk payload size (all uint32_t)
+// Chunk: payload length, CRC32C of payload (both uint32_t), payload
+// The end chunk has length 0, so a file cut at a chunk boundary is detected
+constexpr uint32_t frame_magic = 0x4253594d; // "MYSB"
+constexpr uint32_t frame_version = 1;
+
+// Output stage cutting the byte stream into checksummed chunks
+// The CRC is computed right before a chunk is handed to the sink, while the
+// chunk is still in cache
+class FrameWriter : public std::streambuf {
+public:
+  FrameWriter(std::streambuf* sink, size_t chunk_size)
+      : sink(sink), chunk(chunk_size)
+  {
+    if (chunk_size == 0 || chunk_size > UINT32_MAX) {
+      throw MyErr("FrameWriter: Invalid chunk size");
+    }
+    write_u32(frame_magic);
+    write_u32(frame_version);
+    write_u32(static_cast<uint32_t>(chunk_size));
+    setp(chunk.data(), chunk.data() + chunk.size());
+  }
+
+  // Flush the pending chunk and append the end chunk, called once
+  void finish()
+  {
+    flush_chunk();
+    write_u32(0);
+    write_u32(0);
+    sink->pubsync();
+  }
+
+protected:
+  int_type overflow(int_type ch) override
+  {
+    flush_chunk();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+  int sync() override
+  {
+    flush_chunk();
+    return sink->pubsync();
+  }
+
+private:
+  void flush_chunk()
+  {
+    size_t len = pptr() - pbase();
+    if (len == 0) {
+      return;
+    }
+    write_u32(static_cast<uint32_t>(len));
+    write_u32(crc32c(0, pbase(), len));
+    sink->sputn(pbase(), len);
+    setp(chunk.data(), chunk.data() + chunk.size());
+  }
+  void write_u32(uint32_t value)
+  {
+    sink->sputn(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  std::streambuf* sink;
+  std::vector<char> chunk;
+};
+
+// Input stage verifying every chunk before any byte of it is decoded
+// Throws MyErr on a bad header, a checksum mismatch or a truncated file
+class FrameReader : public std::streambuf {
+public:
+  explicit FrameReader(std::streambuf* source) : source(source)
+  {
+    uint32_t magic, version, chunk_size;
+    if (!read_u32(magic) || magic != frame_magic) {
+      throw MyErr("FrameReader: Not a framed binary archive");
+    }
+    if (!read_u32(version) || version != frame_version) {
+      throw MyErr("FrameReader: Unsupported archive version");
+    }
+    if (!read_u32(chunk_size) || chunk_size == 0) {
+      throw MyErr("FrameReader: Corrupted archive header");
+    }
+    max_chunk = chunk_size;
+  }
+
+  // Verify the rest of the archive up to the end chunk, called once all
+  // data has been decoded so a file cut at a chunk boundary is detected too
+  void finish()
+  {
+    while (!done) {
+      setg(eback(), egptr(), egptr()); // Skip what is left of this chunk
+      underflow();
+    }
+  }
+
+protected:
+  int_type underflow() override
+  {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    if (done) {
+      return traits_type::eof();
+    }
+    uint32_t len, crc;
+    if (!read_u32(len) || !read_u32(crc)) {
+      throw MyErr("FrameReader: Archive truncated");
+    }
+    if (len == 0) { // End chunk
+      done = true;
+      return traits_type::eof();
+    }
+    if (len > max_chunk) {
+      throw MyErr("FrameReader: Corrupted chunk header");
+    }
+    chunk.resize(len);
+    if (static_cast<size_t>(source->sgetn(chunk.data(), len)) != len) {
+      throw MyErr("FrameReader: Archive truncated");
+    }
+    if (crc32c(0, chunk.data(), len) != crc) {
+      throw MyErr("FrameReader: Checksum mismatch");
+    }
+    setg(chunk.data(), chunk.data(), chunk.data() + len);
+    return traits_type::to_int_type(*gptr());
+  }
+
+private:
+  bool read_u32(uint32_t& value)
+  {
+    return source->sgetn(reinterpret_cast<char*>(&value), sizeof(value)) ==
+           sizeof(value);
+  }
+
+  std::streambuf* source;
+  std::vector<char> chunk;
+  uint32_t max_chunk = 0;
+  bool done = false;
+};
+
+// Block compression codec, pluggable into binary archives
+// Blocks are compressed independently, so a codec must be stateless and
+// usable from several threads at once
+class Codec {
+public:
+  virtual ~Codec() = default;
+  // Stored in the archive so a mismatched codec is detected on load
+  virtual uint32_t id() const = 0;
+  // Replace dst with the compressed form of [src, src + len)
+  virtual void compress(const char* src, size_t len,
+                        std::vector<char>& dst) const = 0;
+  // Decompress exactly raw_len bytes into dst, throw MyErr on bad input
+  virtual void decompress(const char* src, size_t len, char* dst,
+                          size_t raw_len) const = 0;
+};
+
+// Self-contained LZ77 codec in the spirit of LZ4
+// Sequence: token (literal length << 4 | match length - 4), extra literal
+// length bytes, literals, 16 bit offset, extra match length bytes
+// Lengths of 15 and above continue in 255-valued bytes
+// The last sequence only carries literals
+class LZCodec : public Codec {
+public:
+  uint32_t id() const override { return 0x315a4c; } // "LZ1"
+
+  void compress(const char* src, size_t len,
+                std::vector<char>& dst) const override
+  {
+    dst.resize(len + len / 255 + 16); // Worst case: all literals
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* ip = base;
+    const unsigned char* anchor = base;
+    const unsigned char* end = base + len;
+    unsigned char* op = reinterpret_cast<unsigned char*>(dst.data());
+
+    if (len >= min_input) {
+      std::vector<uint32_t> table(size_t(1) << hash_bits, 0);
+      const unsigned char* match_limit = end - last_literals - min_match;
+      while (ip < match_limit) {
+        uint32_t seq = load32(ip);
+        uint32_t& slot = table[hash(seq)];
+        const unsigned char* cand = base + slot;
+        slot = static_cast<uint32_t>(ip - base);
+        if (cand < ip && ip - cand <= max_offset && load32(cand) == seq) {
+          const unsigned char* m = ip + min_match;
+          const unsigned char* c = cand + min_match;
+          while (m < end - last_literals && *m == *c) {
+            m++;
+            c++;
+          }
+          op = emit(op, anchor, ip - anchor, m - ip, ip - cand);
+          ip = anchor = m;
+        } else {
+          // Skip faster through data that does not compress
+          ip += 1 + ((ip - anchor) >> 6);
+        }
+      }
+    }
+    op = emit(op, anchor, end - anchor, 0, 0);
+    dst.resize(op - reinterpret_cast<unsigned char*>(dst.data()));
+  }
+
+  void decompress(const char* src, size_t len, char* dst,
+                  size_t raw_len) const override
+  {
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* iend = ip + len;
+    unsigned char* op = reinterpret_cast<unsigned char*>(dst);
+    unsigned char* const ostart = op;
+    unsigned char* const oend = op + raw_len;
+
+    while (ip < iend) {
+      unsigned token = *ip++;
+      size_t lit = read_length(ip, iend, token >> 4);
+      if (lit > size_t(iend - ip) || lit > size_t(oend - op)) {
+        throw MyErr("LZCodec: Corrupted block");
+      }
+      std::memcpy(op, ip, lit);
+      ip += lit;
+      op += lit;
+      if (ip == iend) { // Last sequence
+        break;
+      }
+      if (iend - ip < 2) {
+        throw MyErr("LZCodec: Corrupted block");
+      }
+      size_t offset = ip[0] | (size_t(ip[1]) << 8);
+      ip += 2;
+      size_t mlen = read_length(ip, iend, token & 15) + min_match;
+      if (offset == 0 || offset > size_t(op - ostart) ||
+          mlen > size_t(oend - op)) {
+        throw MyErr("LZCodec: Corrupted block");
+      }
+      const unsigned char* match = op - offset;
+      if (offset >= mlen) {
+        std::memcpy(op, match, mlen);
+        op += mlen;
+      } else { // Overlapping copy repeats the last offset bytes
+        while (mlen--) {
+          *op++ = *match++;
+        }
+      }
+    }
+    if (op != oend) {
+      throw MyErr("LZCodec: Corrupted block");
+    }
+  }
+
+private:
+  static constexpr size_t min_match = 4;
+  static constexpr size_t last_literals = 5; // Block always ends in literals
+  static constexpr size_t min_input = 13;    // Shorter blocks stay literal
+  static constexpr ptrdiff_t max_offset = 65535;
+  static constexpr int hash_bits = 14;
+
+  static uint32_t load32(const unsigned char* p)
+  {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  static uint32_t hash(uint32_t seq)
+  {
+    return (seq * 2654435761u) >> (32 - hash_bits);
+  }
+
+  // Write one sequence, mlen == 0 marks the last (literal only) one
+  static unsigned char* emit(unsigned char* op, const unsigned char* lit_src,
+                             size_t lit, size_t mlen, size_t offset)
+  {
+    unsigned char* token = op++;
+    size_t mcode = mlen ? mlen - min_match : 0;
+    *token = static_cast<unsigned char>((std::min<size_t>(lit, 15) << 4) |
+                                        std::min<size_t>(mcode, 15));
+    op = write_length(op, lit);
+    std::memcpy(op, lit_src, lit);
+    op += lit;
+    if (mlen) {
+      *op++ = static_cast<unsigned char>(offset & 0xff);
+      *op++ = static_cast<unsigned char>(offset >> 8);
+      op = write_length(op, mcode);
+    }
+    return op;
+  }
+  static unsigned char* write_length(unsigned char* op, size_t len)
+  {
+    if (len >= 15) {
+      for (len -= 15; len >= 255; len -= 255) {
+        *op++ = 255;
+      }
+      *op++ = static_cast<unsigned char>(len);
+    }
+    return op;
+  }
+  static size_t read_length(const unsigned char*& ip, const unsigned char* iend,
+                            size_t len)
+  {
+    if (len == 15) {
+      unsigned char b;
+      do {
+        if (ip == iend) {
+          throw MyErr("LZCodec: Corrupted block");
+        }
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    return len;
+  }
+};
+
+// Compressed stream: [magic][codec id][block]...[end block]
+// Block: raw length, stored length (both uint32_t), stored bytes
+// Blocks that do not shrink are stored as is (stored length == raw length)
+// The end block has raw length 0
+constexpr uint32_t compress_magic = 0x5a53594d; // "MYSZ"
+
+// Output stage compressing fixed-size blocks
+// With threads > 1, that many blocks are buffered and compressed in parallel
+// before being written in order
+class CompressWriter : public std::streambuf {
+public:
+  CompressWriter(std::streambuf* sink, std::shared_ptr<const Codec> codec,
+                 size_t block_size, unsigned threads)
+      : sink(sink), codec(std::move(codec)), block_size(block_size),
+        blocks(std::max(threads, 1u))
+  {
+    if (block_size == 0 || block_size > UINT32_MAX / 2) {
+      throw MyErr("CompressWriter: Invalid block size");
+    }
+    write_u32(compress_magic);
+    write_u32(this->codec->id());
+    for (Block& block : blocks) {
+      block.raw.resize(block_size);
+    }
+    setp(blocks[0].raw.data(), blocks[0].raw.data() + block_size);
+  }
+  CompressWriter(const CompressWriter&) = delete;
+  CompressWriter& operator=(const CompressWriter&) = delete;
+  ~CompressWriter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Flush pending blocks and append the end block, called once
+  void finish()
+  {
+    flush_blocks();
+    write_u32(0);
+    write_u32(0);
+    sink->pubsync();
+  }
+
+protected:
+  int_type overflow(int_type ch) override
+  {
+    blocks[filled++].len = block_size;
+    setp(nullptr, nullptr); // Already accounted for
+    if (filled == blocks.size()) {
+      flush_blocks();
+    } else {
+      setp(blocks[filled].raw.data(), blocks[filled].raw.data() + block_size);
+    }
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+  int sync() override
+  {
+    flush_blocks();
+    return sink->pubsync();
+  }
+
+private:
+  struct Block {
+    std::vector<char> raw;
+    std::vector<char> packed;
+    size_t len = 0; // Used bytes of raw
+  };
+
+  // Compress and write every full block plus the partially filled one
+  void flush_blocks()
+  {
+    size_t cnt = filled;
+    if (pptr() != pbase()) {
+      blocks[cnt++].len = pptr() - pbase();
+    }
+    if (cnt == 0) {
+      return;
+    }
+    if (cnt == 1) {
+      pack(blocks[0]);
+    } else {
+      pack_parallel(cnt);
+    }
+    for (size_t i = 0; i < cnt; i++) {
+      const Block& block = blocks[i];
+      bool shrunk = block.packed.size() < block.len;
+      write_u32(static_cast<uint32_t>(block.len));
+      write_u32(static_cast<uint32_t>(shrunk ? block.packed.size()
+                                             : block.len));
+      sink->sputn(shrunk ? block.packed.data() : block.raw.data(),
+                  shrunk ? block.packed.size() : block.len);
+    }
+    filled = 0;
+    setp(blocks[0].raw.data(), blocks[0].raw.data() + block_size);
+  }
+  void pack(Block& block) const
+  {
+    codec->compress(block.raw.data(), block.len, block.packed);
+  }
+
+  // Compress blocks [0, cnt) on the workers, this thread takes a share too
+  // Workers are started on the first call and kept until destruction
+  void pack_parallel(size_t cnt)
+  {
+    if (workers.empty()) {
+      for (size_t i = 1; i < blocks.size(); i++) {
+        workers.emplace_back([this] { work(); });
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs = cnt;
+      next.store(0, std::memory_order_relaxed);
+      running = workers.size();
+      round++;
+    }
+    wake.notify_all();
+    take_blocks();
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return running == 0; });
+    if (error) {
+      std::exception_ptr first = error;
+      error = nullptr;
+      std::rethrow_exception(first);
+    }
+  }
+  void take_blocks()
+  {
+    try {
+      for (size_t i; (i = next.fetch_add(1)) < jobs;) {
+        pack(blocks[i]);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  void work()
+  {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stop || round != seen; });
+        if (stop) {
+          return;
+        }
+        seen = round;
+      }
+      take_blocks();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--running == 0) {
+        done.notify_one();
+      }
+    }
+  }
+  void write_u32(uint32_t value)
+  {
+    sink->sputn(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  std::streambuf* sink;
+  std::shared_ptr<const Codec> codec;
+  size_t block_size;
+  std::vector<Block> blocks;
+  size_t filled = 0; // Full blocks waiting to be compressed
+  // Worker pool, see pack_parallel()
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake; // Workers: new round or stop
+  std::condition_variable done; // Flushing thread: every worker finished
+  uint64_t round = 0;
+  size_t jobs = 0;    // Blocks of this round
+  size_t running = 0; // Workers still in this round
+  std::atomic<size_t> next = 0; // Next block to take
+  std::exception_ptr error;     // First compression error of this round
+  bool stop = false;
+};
+
+// Input stage decompressing one block at a time (streaming)
+class CompressReader : public std::streambuf {
+public:
+  // Blocks are at most block_size raw bytes, as written with the same
+  // options; larger lengths are corruption and are not allocated
+  CompressReader(std::streambuf* source, std::shared_ptr<const Codec> codec,
+                 size_t block_size)
+      : source(source), codec(std::move(codec)), block_size(block_size)
+  {
+    uint32_t magic, id;
+    if (!read_u32(magic) || magic != compress_magic) {
+      throw MyErr("CompressReader: Not a compressed binary archive");
+    }
+    if (!read_u32(id) || id != this->codec->id()) {
+      throw MyErr("CompressReader: Archive uses another codec");
+    }
+  }
+
+  // Skip to the end block, so the stages below see the whole archive
+  void finish()
+  {
+    while (!done) {
+      setg(eback(), egptr(), egptr());
+      underflow();
+    }
+  }
+
+protected:
+  int_type underflow() override
+  {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    if (done) {
+      return traits_type::eof();
+    }
+    uint32_t raw_len, stored_len;
+    if (!read_u32(raw_len) || !read_u32(stored_len)) {
+      throw MyErr("CompressReader: Archive truncated");
+    }
+    if (raw_len == 0) { // End block
+      done = true;
+      return traits_type::eof();
+    }
+    if (stored_len > raw_len || raw_len > block_size) {
+      throw MyErr("CompressReader: Corrupted block header");
+    }
+    raw.resize(raw_len);
+    char* target = raw.data(); // Stored blocks go straight to raw
+    if (stored_len != raw_len) {
+      packed.resize(stored_len);
+      target = packed.data();
+    }
+    if (static_cast<size_t>(source->sgetn(target, stored_len)) !=
+        stored_len) {
+      throw MyErr("CompressReader: Archive truncated");
+    }
+    if (stored_len != raw_len) {
+      codec->decompress(packed.data(), stored_len, raw.data(), raw_len);
+    }
+    setg(raw.data(), raw.data(), raw.data() + raw_len);
+    return traits_type::to_int_type(*gptr());
+  }
+
+private:
+  bool read_u32(uint32_t& value)
+  {
+    return source->sgetn(reinterpret_cast<char*>(&value), sizeof(value)) ==
+           sizeof(value);
+  }
+
+  std::streambuf* source;
+  std::shared_ptr<const Codec> codec;
+  size_t block_size; // Largest raw block accepted
+  std::vector<char> raw;
+  std::vector<char> packed;
+  bool done = false;
+};
+
+// Storage for strings deduplicated while loading
+// Strings are copied into large blocks once, every later copy of the same
+// content gets a view of the stored one
+// Views stay valid as long as the arena lives
+// Blocks and index come from resource, e.g. a caller-owned monotonic arena
+class StringArena {
+public:
+  explicit StringArena(
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+      : blocks(block_size, resource), index(resource)
+  {
+  }
+
+  std::string_view intern(std::string_view str)
+  {
+    auto it = index.find(str);
+    if (it != index.end()) {
+      return *it;
+    }
+    char* stored = static_cast<char*>(blocks.allocate(str.size() + 1, 1));
+    std::memcpy(stored, str.data(), str.size());
+    std::string_view view(stored, str.size());
+    index.insert(view);
+    return view;
+  }
+  // Number of distinct strings
+  size_t size() const { return index.size(); }
+
+private:
+  static constexpr size_t block_size = 1 << 16; // First block, then grows
+  std::pmr::monotonic_buffer_resource blocks;   // Freed all at once
+  std::pmr::unordered_set<std::string_view> index;
+};
+
+// Hash allowing lookups of std::string keys by std::string_view
+struct StringHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view str) const
+  {
+    return std::hash<std::string_view>()(str);
+  }
+};
+
+// Encoding of the keys of std::set and std::map with integer keys
+// raw: full width, in ascending order like every other value
+// delta: first key, then gaps to the previous key, all as varints
+// packed: blocks of 128 keys, each stored as its first key plus bit-packed
+//         offsets from it (frame of reference), unpacked with SIMD
+enum class KeyEncoding { raw, delta, packed };
+
+// Integer types whose sorted sequences can use KeyEncoding
+template <class T>
+constexpr bool is_int_key = std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
+// Encoding of std::vector<float> and std::vector<double>
+// raw: IEEE bytes
+// gorilla: XOR with the previous value, leading/trailing zeros bit-packed,
+//          for slowly varying series such as metrics
+enum class FloatEncoding { raw, gorilla };
+
+// Vector of float or double that is always stored with
+// FloatEncoding::gorilla in binary archives, to choose the codec per field
+// Behaves as a std::vector otherwise (and in XML)
+template <class T>
+class FloatSeries : public std::vector<T> {
+  static_assert(std::is_floating_point_v<T>, "FloatSeries needs float types");
+
+public:
+  using std::vector<T>::vector;
+};
+
+#ifdef MY_SERIALIZER_HAS_URING
+// Minimal io_uring on raw system calls (no liburing): one submission queue
+// and one completion queue mapped from the kernel
+// Only one thread may use a ring, every submission goes out right away
+class IoRing {
+public:
+  explicit IoRing(unsigned entries)
+  {
+    io_uring_params params = {};
+    fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) {
+      return; // Not supported or not permitted, ok() tells
+    }
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+      sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sq_ring = map(sq_size, IORING_OFF_SQ_RING);
+    cq_ring = single ? sq_ring : map(cq_size, IORING_OFF_CQ_RING);
+    sqes = static_cast<io_uring_sqe*>(map(sqes_size, IORING_OFF_SQES));
+    if (!sq_ring || !cq_ring || !sqes) {
+      release();
+      return;
+    }
+    char* sq = static_cast<char*>(sq_ring);
+    char* cq = static_cast<char*>(cq_ring);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  }
+  IoRing(const IoRing&) = delete;
+  IoRing& operator=(const IoRing&) = delete;
+  ~IoRing() { release(); }
+
+  bool ok() const { return fd >= 0; }
+
+  // Start a read or write (IORING_OP_READ / IORING_OP_WRITE) of len bytes
+  // at offset, tag comes back with its completion
+  // The caller keeps at most as many requests in flight as the ring has
+  // entries
+  void submit(uint8_t opcode, int file, char* data, unsigned len,
+              uint64_t offset, uint64_t tag)
+  {
+    unsigned tail = *sq_tail; // Only written by us
+    unsigned index = tail & sq_mask;
+    io_uring_sqe& sqe = sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = file;
+    sqe.addr = reinterpret_cast<uint64_t>(data);
+    sqe.len = len;
+    sqe.off = offset;
+    sqe.user_data = tag;
+    sq_array[index] = index;
+    std::atomic_ref<unsigned>(*sq_tail).store(tail + 1,
+                                              std::memory_order_release);
+    while (enter(1, 0, 0) < 0) {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        throw MyErr("IoRing: Cannot submit");
+      }
+    }
+  }
+
+  // Wait for the next completion: tag and result (bytes or -errno)
+  std::pair<uint64_t, int> wait()
+  {
+    while (true) {
+      unsigned head = *cq_head; // Only written by us
+      unsigned tail =
+          std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+      if (head != tail) {
+        const io_uring_cqe& cqe = cqes[head & cq_mask];
+        std::pair<uint64_t, int> done = {cqe.user_data, cqe.res};
+        std::atomic_ref<unsigned>(*cq_head).store(head + 1,
+                                                  std::memory_order_release);
+        return done;
+      }
+      if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        throw MyErr("IoRing: Cannot wait for completions");
+      }
+    }
+  }
+
+private:
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+  {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                      min_complete, flags, nullptr, 0));
+  }
+  void* map(size_t size, off_t offset)
+  {
+    void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, offset);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+  }
+  void release()
+  {
+    if (sqes) {
+      ::munmap(sqes, sqes_size);
+    }
+    if (cq_ring && cq_ring != sq_ring) {
+      ::munmap(cq_ring, cq_size);
+    }
+    if (sq_ring) {
+      ::munmap(sq_ring, sq_size);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    fd = -1;
+  }
+
+  int fd = -1;
+  size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+  void* sq_ring = nullptr;
+  void* cq_ring = nullptr;
+  io_uring_sqe* sqes = nullptr;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_array = nullptr;
+  unsigned sq_mask = 0;
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  unsigned cq_mask = 0;
+  io_uring_cqe* cqes = nullptr;
+};
+#endif
+
+#ifdef MY_SERIALIZER_HAS_PREAD
+// Shared part of AsyncFileWriter and AsyncFileReader: a file, depth chunk
+// buffers and the requests in flight on them
+// Requests go through io_uring when the kernel has it, otherwise they are
+// done right away with pwrite() / pread()
+// Threaded: requests are queued to a dedicated I/O thread doing pwrite() /
+// pread(), so the copy into the page cache also overlaps with encoding
+// With direct I/O (O_DIRECT) the page cache is bypassed: buffers, offsets and
+// lengths are multiples of direct_align. File systems that refuse O_DIRECT
+// get buffered I/O instead
+class AsyncFile {
+public:
+  AsyncFile(const AsyncFile&) = delete;
+  AsyncFile& operator=(const AsyncFile&) = delete;
+
+  // Covers the logical block size of common devices (512 or 4096 bytes)
+  static constexpr size_t direct_align = 4096;
+
+protected:
+  struct AlignedFree {
+    void operator()(char* ptr) const { std::free(ptr); }
+  };
+  struct Chunk {
+    std::unique_ptr<char, AlignedFree> data;
+    size_t capacity = 0;  // Size of data
+    size_t len = 0;       // Bytes of the request
+    uint64_t offset = 0;  // Position of the request in the file
+    bool busy = false;    // Request in flight
+  };
+
+  AsyncFile(const std::string& file_name, int flags, size_t chunk_size,
+            unsigned depth, bool direct_io, bool threaded)
+      : chunks(std::max(depth, 1u))
+  {
+#ifdef O_DIRECT
+    if (direct_io) {
+      fd = ::open(file_name.c_str(), flags | O_DIRECT, 0644);
+      direct = fd >= 0;
+    }
+#endif
+    if (fd < 0) {
+      fd = ::open(file_name.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+      throw MyErr("AsyncFile: Failed to open " + file_name);
+    }
+    size_t capacity = round_up(std::max<size_t>(chunk_size, 1));
+    for (Chunk& chunk : chunks) {
+      chunk.data.reset(
+          static_cast<char*>(std::aligned_alloc(direct_align, capacity)));
+      if (!chunk.data) {
+        ::close(fd);
+        throw std::bad_alloc();
+      }
+      chunk.capacity = capacity;
+    }
+    if (threaded) {
+      mode = Mode::thread;
+      io_thread = std::thread([this] { run(); });
+      return;
+    }
+#ifdef MY_SERIALIZER_HAS_URING
+    ring.emplace(static_cast<unsigned>(chunks.size()));
+    if (ring->ok()) {
+      mode = Mode::uring;
+    } else {
+      ring.reset();
+    }
+#endif
+  }
+  ~AsyncFile()
+  {
+    // The kernel or the I/O thread may still access the buffers
+    try {
+      wait_all();
+    } catch (MyErr&) {
+    }
+    if (io_thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      changed.notify_all();
+      io_thread.join();
+    }
+    ::close(fd);
+  }
+
+  static size_t round_up(size_t len)
+  {
+    return (len + direct_align - 1) / direct_align * direct_align;
+  }
+
+  // Start the request of a chunk, done before returning without io_uring
+  // or I/O thread
+  void start(size_t index)
+  {
+    Chunk& chunk = chunks[index];
+    if (mode == Mode::thread) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunk.busy = true;
+        queue.push_back(index);
+      }
+      changed.notify_all();
+      return;
+    }
+#ifdef MY_SERIALIZER_HAS_URING
+    if (mode == Mode::uring) {
+      ring->submit(write_mode ? IORING_OP_WRITE : IORING_OP_READ, fd,
+                  chunk.data.get(), static_cast<unsigned>(io_len(chunk, 0)),
+                  chunk.offset, index);
+      chunk.busy = true;
+      return;
+    }
+#endif
+    fail(transfer(chunk, 0));
+  }
+
+  // Wait until the request of a chunk is done
+  void wait(size_t index)
+  {
+    if (mode == Mode::thread) {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [&] { return !chunks[index].busy; });
+      return;
+    }
+    while (chunks[index].busy) {
+      reap();
+    }
+  }
+  void wait_all()
+  {
+    for (size_t i = 0; i < chunks.size(); i++) {
+      wait(i);
+    }
+  }
+
+  // Keep the first error of any request
+  void fail(int err)
+  {
+    int none = 0;
+    error.compare_exchange_strong(none, err);
+  }
+
+  std::atomic<int> error = 0; // First error of any request, 0 if none
+  int fd = -1;
+  bool write_mode = false;
+  bool direct = false; // Opened with O_DIRECT
+  std::vector<Chunk> chunks;
+
+private:
+  // Chunks are only busy here if they were submitted to the ring, which is
+  // kept after a fallback until every request on it is done
+  void reap()
+  {
+#ifdef MY_SERIALIZER_HAS_URING
+    auto [tag, res] = ring->wait();
+    Chunk& chunk = chunks[tag];
+    chunk.busy = false;
+    if (res == -EINVAL) {
+      mode = Mode::blocking; // Kernel without IORING_OP_READ / _WRITE
+      fail(transfer(chunk, 0));
+    } else if (res < 0) {
+      fail(-res);
+    } else if (static_cast<size_t>(res) < chunk.len) {
+      fail(transfer(chunk, res)); // Short transfer, finish it here
+    }
+#endif
+  }
+
+  // The I/O thread: requests in order, one at a time
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      changed.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      size_t index = queue.front();
+      queue.pop_front();
+      lock.unlock();
+      fail(transfer(chunks[index], 0));
+      lock.lock();
+      chunks[index].busy = false;
+      changed.notify_all();
+    }
+  }
+
+  // Bytes to request from byte done of a chunk on. Direct reads ask for
+  // whole blocks, the end of the file cuts them short
+  size_t io_len(const Chunk& chunk, size_t done) const
+  {
+    size_t len = chunk.len - done;
+    return direct && !write_mode ? round_up(len) : len;
+  }
+
+  // Blocking transfer of the chunk from byte done on, returns the error
+  // Direct I/O resumes a short transfer at the block boundary before done,
+  // since O_DIRECT rejects unaligned offsets and lengths
+  int transfer(Chunk& chunk, size_t done)
+  {
+    while (done < chunk.len) {
+      if (direct && done % direct_align != 0) {
+        done = done / direct_align * direct_align;
+      }
+      char* data = chunk.data.get() + done;
+      size_t len = io_len(chunk, done);
+      off_t offset = static_cast<off_t>(chunk.offset + done);
+      ssize_t n = write_mode ? ::pwrite(fd, data, len, offset)
+                             : ::pread(fd, data, len, offset);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return n < 0 ? errno : EIO;
+      }
+      if (direct && done + n < chunk.len &&
+          (done + n) / direct_align * direct_align == done) {
+        return EIO; // Less than a block done, resuming would not progress
+      }
+      done += n;
+    }
+    return 0;
+  }
+
+  // Where requests go, fixed by the constructor except for the fallback
+  // from uring to blocking
+  enum class Mode {
+    blocking, // pwrite() / pread() before start() returns
+    uring,    // Submitted to ring
+    thread,   // Queued to io_thread
+  };
+  Mode mode = Mode::blocking;
+#ifdef MY_SERIALIZER_HAS_URING
+  std::optional<IoRing> ring; // Only set up without I/O thread
+#endif
+  std::mutex mutex; // Guards busy flags and queue with the I/O thread
+  std::condition_variable changed;
+  std::deque<size_t> queue; // Chunks waiting for the I/O thread
+  bool stopping = false;
+  std::thread io_thread;
+};
+
+// Output stage writing a file in large chunks, while one chunk is written
+// the next is filled
+class AsyncFileWriter : public std::streambuf, private AsyncFile {
+public:
+  AsyncFileWriter(const std::string& file_name, size_t chunk_size,
+                  unsigned depth, bool direct_io = false,
+                  bool threaded = false)
+      : AsyncFile(file_name, O_WRONLY | O_CREAT | O_TRUNC, chunk_size, depth,
+                  direct_io, threaded)
+  {
+    write_mode = true;
+    setp(chunks[0].data.get(), chunks[0].data.get() + chunks[0].capacity);
+  }
+
+  // Write the pending bytes and wait for all chunks, throws on errors
+  void finish()
+  {
+    submit();
+    wait_all();
+    // A direct write of the tail went up to the next block, cut it off
+    if (!error && direct && offset % direct_align != 0 &&
+        ::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+      fail(errno);
+    }
+    if (error) {
+      throw MyErr(std::string("AsyncFileWriter: ") + std::strerror(error));
+    }
+  }
+
+protected:
+  int_type overflow(int_type ch) override
+  {
+    submit();
+    current = (current + 1) % chunks.size();
+    wait(current); // Reuse its buffer
+    Chunk& chunk = chunks[current];
+    setp(chunk.data.get(), chunk.data.get() + chunk.capacity);
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+  int sync() override { return 0; } // Chunks stay large, finish() flushes
+
+private:
+  // Start writing the filled part of the current chunk
+  void submit()
+  {
+    Chunk& chunk = chunks[current];
+    chunk.len = pptr() - pbase();
+    setp(pptr(), pptr());
+    if (chunk.len > 0) {
+      chunk.offset = offset;
+      offset += chunk.len;
+      if (direct) {
+        // Only the last chunk can be partial, pad it to whole blocks
+        size_t padded = round_up(chunk.len);
+        std::memset(chunk.data.get() + chunk.len, 0, padded - chunk.len);
+        chunk.len = padded;
+      }
+      start(current);
+    }
+  }
+
+  size_t current = 0;  // Chunk being filled
+  uint64_t offset = 0; // Where it goes in the file
+};
+
+// Input stage reading a file in large chunks, the next depth - 1 chunks are
+// read ahead while one is decoded
+class AsyncFileReader : public std::streambuf, private AsyncFile {
+public:
+  AsyncFileReader(const std::string& file_name, size_t chunk_size,
+                  unsigned depth, bool direct_io = false,
+                  bool threaded = false)
+      : AsyncFile(file_name, O_RDONLY, chunk_size, depth, direct_io,
+                  threaded),
+        chunk_size(chunks[0].capacity) // Whole blocks for direct reads
+  {
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+      throw MyErr("AsyncFileReader: Cannot stat " + file_name);
+    }
+    size = info.st_size;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      request(i);
+    }
+  }
+
+protected:
+  int_type underflow() override
+  {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    if (next > 0) {
+      // Done with the previous chunk, its buffer reads ahead
+      request(next - 1 + chunks.size());
+    }
+    if (next * chunk_size >= size) {
+      return traits_type::eof();
+    }
+    size_t index = next++ % chunks.size();
+    wait(index);
+    if (error) {
+      throw MyErr(std::string("AsyncFileReader: ") + std::strerror(error));
+    }
+    Chunk& chunk = chunks[index];
+    setg(chunk.data.get(), chunk.data.get(),
+         chunk.data.get() + chunk.len);
+    return traits_type::to_int_type(*gptr());
+  }
+
+private:
+  // Start reading chunk number n of the file into its buffer
+  void request(uint64_t n)
+  {
+    if (n * chunk_size >= size) {
+      return;
+    }
+    size_t index = n % chunks.size();
+    Chunk& chunk = chunks[index];
+    chunk.offset = n * chunk_size;
+    chunk.len = std::min<uint64_t>(chunk_size, size - chunk.offset);
+    start(index);
+  }
+
+  size_t chunk_size;
+  uint64_t size = 0; // Of the file
+  uint64_t next = 0; // Chunk to hand out next
+};
+#else
+// Without POSIX files async_io is ignored and these are never created
+class AsyncFileWriter : public std::streambuf {
+public:
+  void finish() {}
+};
+class AsyncFileReader : public std::streambuf {};
+#endif
+
+// Options of binary archives
+// Both sides have to use the same options, like XMLMode for XML files
+struct BinaryOptions {
+  bool framed = false;          // Header + CRC32C checked chunks
+  size_t chunk_size = 1 << 16; // Payload bytes per chunk when framed
+  std::shared_ptr<const Codec> codec; // Block compression, none if empty
+  size_t block_size = 1 << 20;        // Raw bytes per block, loads too
+  unsigned threads = 1;               // Blocks compressed in parallel
+  bool columnar = false; // Vectors of user-defined types stored by column
+  KeyEncoding key_encoding = KeyEncoding::raw; // Integer set/map keys
+  FloatEncoding float_encoding = FloatEncoding::raw; // Float vectors
+  bool pack_integers = false; // Integer vectors bit-packed above their min
+  bool string_table = false; // Repeated strings written as references
+  // Arena for loaded strings, required to load std::string_view
+  std::shared_ptr<StringArena> strings;
+  // Where the string arena created for string_table loads allocates
+  std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+  // Reserve the exact file size up front (fallocate) before writing
+  bool preallocate = false;
+  // Files written and read in io_chunk sized pieces with io_depth of them
+  // in flight (io_uring on Linux, pwrite/pread elsewhere), by file name only
+  bool async_io = false;
+  unsigned io_depth = 4;
+  size_t io_chunk = 1 << 20;
+  // async_io bypassing the page cache (O_DIRECT), so big saves and loads do
+  // not evict the working set of the process
+  bool direct_io = false;
+  // async_io with a dedicated I/O thread instead of io_uring: the encoder
+  // fills one buffer while the thread writes the previous ones (or reads
+  // the next ones when loading)
+  bool pipelined = false;
+  // Replace the file atomically and durably, see FileIO
+  bool atomic = false;
+  // Leave the file alone if it already holds the same bytes, decided by a
+  // fingerprint (hash and size) kept in file_name + ".hash"
+  // A first encoding pass only hashes the bytes, nothing touches the disk
+  // unless the fingerprint changed; then the data is encoded again into
+  // the file
+  // The file itself is never read: only its size is checked, so an edit by
+  // other means that keeps the size goes unnoticed and the file is not
+  // rewritten (such writers have to call FileIO::drop_fingerprint)
+  bool skip_unchanged = false;
+
+  // True if the bytes are the plain encoding of the values, no stages and
+  // no alternative encodings
+  bool plain() const
+  {
+    return !framed && !codec && !columnar &&
+           key_encoding == KeyEncoding::raw &&
+           float_encoding == FloatEncoding::raw && !pack_integers &&
+           !string_table;
+  }
+};
+
+struct Patch; // Writes and applies changes between two states
+
+class BinarySerializer {
+public:
+  BinarySerializer(const std::string& file_name,
+                   const BinaryOptions& options = {})
+      : options(options), file_name(file_name), buf(&file)
+  {
+    // Save mode: open and clear target file in binary mode, create target
+    // file if not exist
+    FileIO::drop_fingerprint(file_name);
+#ifdef MY_SERIALIZER_HAS_PREAD
+    if (options.async_io || options.direct_io || options.pipelined) {
+      async = std::make_unique<AsyncFileWriter>(file_name, options.io_chunk,
+                                                options.io_depth,
+                                                options.direct_io,
+                                                options.pipelined);
+      buf = async.get();
+    }
+#endif
+    if (!async) {
+      file.open(file_name,
+                std::ios::binary | std::ios::out | std::ios::trunc);
+    }
+    add_stages();
+  }
+  // Write to any stream buffer instead of a file (memory, filter stages...)
+  // The buffer is not owned and has to outlive the serializer
+  explicit BinarySerializer(std::streambuf* target,
+                            const BinaryOptions& options = {})
+      : options(options), buf(target)
+  {
+    add_stages();
+  }
+  ~BinarySerializer()
+  {
+    if (!closed) {
+      try {
+        close();
+      } catch (MyErr&) {
+        // Destructors cannot report errors, call close() to get them
+      }
+    }
+  }
+
+  // Flush stages top-down, the last block must reach the file, then close
+  // the file. Throws if the file could not be opened or written
+  void close()
+  {
+    closed = true;
+    if (compress)
+      compress->finish();
+    if (frame)
+      frame->finish();
+    if (async) {
+      async->finish();
+    } else if (!file_name.empty() && (!file.is_open() || !file.close())) {
+      throw MyErr("BinarySerializer: Cannot write " + file_name);
+    }
+  }
+
+  // Reserve the final file size on disk before writing, to avoid
+  // fragmentation (only a hint, ignored where unsupported)
+  void reserve(size_t bytes)
+  {
+#ifdef __linux__
+    if ((file.is_open() || async) && bytes > 0) {
+      int fd = ::open(file_name.c_str(), O_WRONLY);
+      if (fd >= 0) {
+        ::posix_fallocate(fd, 0, static_cast<off_t>(bytes));
+        ::close(fd);
+      }
+    }
+#else
+    (void)bytes;
+#endif
+  }
+
+  // Bytes encoded elsewhere with the same options, passed through as is
+  void write_encoded(const char* bytes, size_t len)
+  {
+    if (static_cast<size_t>(buf->sputn(bytes, len)) != len) {
+      throw MyErr("BinarySerializer: Cannot write " + file_name);
+    }
+  }
+
+  // Key can be ignored in Binary Serialization
+
+  // Common asset for external call
+  template <class T>
+  void process(const T& data)
+  {
+    value(data);
+  }
+
+  // Archive hooks, see Traversal
+  // Containers are their length followed by the items, nothing else
+  static constexpr bool loading = false;
+
+  // Basic types: arithmetic & string
+  // Template only accepts arithmatic types
+  template <class T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+  void leaf(const T& data)
+  {
+    // Write in data
+    buf->sputn(reinterpret_cast<const char*>(&data), sizeof(data));
+  }
+  // String
+  void leaf(const std::string& data)
+  {
+    leaf(std::string_view(data));
+  }
+  // String view, same encoding as string
+  void leaf(std::string_view data)
+  {
+    if (options.string_table) {
+      process_ref(data);
+      return;
+    }
+    size_t len = data.length(); // Start with lenth
+    leaf(len);                  // Write len in file
+    buf->sputn(data.data(), len);
+  }
+  size_t begin_sequence(const char*, size_t len)
+  {
+    leaf(len);
+    return len;
+  }
+  void end_sequence() {}
+  void begin_object(const char*) {}
+  void end_object() {}
+  void begin_item(const char*) {}
+  void end_item() {}
+  Traversal::SharedObjects& shared_objects() { return shared; }
+
+  // Nested data, every type not listed below goes through Traversal
+  template <class T>
+  void value(const T& data)
+  {
+    Traversal::traverse(*this, data);
+  }
+  // Vector
+  template <class T>
+  void value(const std::vector<T>& data)
+  {
+    if constexpr (Traversal::has_members<T>) {
+      if (options.columnar) {
+        process_columns(data);
+        return;
+      }
+    }
+    if constexpr (std::is_floating_point_v<T>) {
+      if (options.float_encoding == FloatEncoding::gorilla) {
+        process_gorilla(data);
+        return;
+      }
+    }
+    if constexpr (is_int_key<T>) {
+      if (options.pack_integers) {
+        process_packed(data);
+        return;
+      }
+    }
+    Traversal::traverse(*this, data);
+  }
+  template <class T>
+  void value(const FloatSeries<T>& data)
+  {
+    process_gorilla(data);
+  }
+  // Vector of bool: length, then 8 flags per byte (lowest bit first)
+  void value(const std::vector<bool>& data)
+  {
+    process(data.size());
+    std::vector<char> bytes((data.size() + 7) / 8, 0);
+    for (size_t i = 0; i < data.size(); i++) {
+      bytes[i / 8] |= static_cast<char>(data[i] << (i % 8));
+    }
+    buf->sputn(bytes.data(), bytes.size());
+  }
+  // Bitset: N is known, so only the packed bytes
+  template <size_t N>
+  void value(const std::bitset<N>& data)
+  {
+    char bytes[(N + 7) / 8 + 1] = {}; // + 1 keeps N == 0 legal
+    for (size_t i = 0; i < N; i++) {
+      bytes[i / 8] |= static_cast<char>(data[i] << (i % 8));
+    }
+    buf->sputn(bytes, (N + 7) / 8);
+  }
+  // Set, with any allocator
+  template <class T, class Alloc>
+  void value(const std::set<T, std::less<T>, Alloc>& data)
+  {
+    if constexpr (is_int_key<T>) {
+      if (options.key_encoding != KeyEncoding::raw) {
+        process(data.size());
+        process_keys(std::vector<T>(data.begin(), data.end()));
+        return;
+      }
+    }
+    Traversal::traverse(*this, data);
+  }
+  // Map, with any allocator
+  template <class T1, class T2, class Alloc>
+  void value(const std::map<T1, T2, std::less<T1>, Alloc>& data)
+  {
+    if constexpr (is_int_key<T1>) {
+      if (options.key_encoding != KeyEncoding::raw) {
+        // All keys first so they can be encoded as one sorted sequence
+        std::vector<T1> keys;
+        keys.reserve(data.size());
+        for (const auto& item : data) {
+          keys.push_back(item.first);
+        }
+        process(data.size());
+        process_keys(keys);
+        for (const auto& item : data) {
+          process(item.second);
+        }
+        return;
+      }
+    }
+    Traversal::traverse(*this, data);
+  }
+
+private:
+  friend struct Patch;
+
+  // Columnar layout of vector<T>: length, then one column per field
+  // Every column is prefixed with its size in bytes so readers can skip it
+  template <class T>
+  void process_columns(const std::vector<T>& data)
+  {
+    process(data.size());
+    std::apply([&](auto... member) { (process_column(data, member), ...); },
+               UserFields<T>::members());
+  }
+  template <class T, class F, class C>
+  void process_column(const std::vector<T>& data, F C::*member)
+  {
+    std::stringbuf column;
+    if constexpr (std::is_arithmetic<F>::value) {
+      // Gather into one contiguous block and write it in one go
+      // (an array, vector<bool> has no contiguous storage)
+      auto values = std::make_unique_for_overwrite<F[]>(data.size());
+      for (size_t i = 0; i < data.size(); i++) {
+        values[i] = data[i].*member;
+      }
+      column.sputn(reinterpret_cast<const char*>(values.get()),
+                   data.size() * sizeof(F));
+    } else {
+      // Same encoding without stages, and a string table of its own so
+      // that columns stay readable on their own
+      BinarySerializer column_processor(&column, column_options());
+      for (const T& value : data) {
+        column_processor.process(value.*member);
+      }
+    }
+    const std::string& bytes = column.str();
+    process(bytes.size());
+    buf->sputn(bytes.data(), bytes.size());
+  }
+
+  // String table: one varint tag per string
+  // Even tag: a new string of tag / 2 bytes follows and gets the next id
+  // Odd tag: repeat of the string with id tag / 2
+  void process_ref(std::string_view data)
+  {
+    auto it = string_ids.find(data);
+    if (it != string_ids.end()) {
+      write_varint((uint64_t(it->second) << 1) | 1);
+      return;
+    }
+    string_ids.emplace(data, string_ids.size());
+    write_varint(uint64_t(data.size()) << 1);
+    buf->sputn(data.data(), data.size());
+  }
+
+  BinaryOptions column_options() const
+  {
+    BinaryOptions result = options;
+    result.framed = false;
+    result.codec = nullptr;
+    return result;
+  }
+
+  // Length, size of the encoded values in bytes, encoded values
+  template <class T>
+  void process_gorilla(const std::vector<T>& data)
+  {
+    std::vector<char> encoded;
+    detail::gorilla_encode(data.data(), data.size(), encoded);
+    process(data.size());
+    process(encoded.size());
+    buf->sputn(encoded.data(), encoded.size());
+  }
+
+  // Length, minimum, bit width, then blocks of 128 offsets from the minimum
+  // packed like KeyEncoding::packed (plain 64 bit offsets above 32 bits)
+  template <class T>
+  void process_packed(const std::vector<T>& data)
+  {
+    using U = std::make_unsigned_t<T>;
+    process(data.size());
+    if (data.empty()) {
+      return;
+    }
+    auto [lo, hi] = std::minmax_element(data.begin(), data.end());
+    T base = *lo;
+    uint8_t width = static_cast<uint8_t>(std::bit_width(U(U(*hi) - U(base))));
+    process(base);
+    process(width);
+    alignas(16) uint32_t offsets[detail::pack_block];
+    alignas(16) uint32_t words[detail::pack_block];
+    for (size_t start = 0; start < data.size(); start += detail::pack_block) {
+      size_t cnt = std::min(detail::pack_block, data.size() - start);
+      if (width <= 32) {
+        std::fill(offsets + cnt, offsets + detail::pack_block, 0u);
+        for (size_t i = 0; i < cnt; i++) {
+          offsets[i] = static_cast<uint32_t>(U(data[start + i]) - U(base));
+        }
+        detail::pack128(offsets, width, words);
+        buf->sputn(reinterpret_cast<const char*>(words),
+                   4 * width * sizeof(uint32_t));
+      } else {
+        for (size_t i = 0; i < cnt; i++) {
+          process(uint64_t(U(U(data[start + i]) - U(base))));
+        }
+      }
+    }
+  }
+
+  // Unsigned LEB128
+  void write_varint(uint64_t value)
+  {
+    char bytes[10];
+    size_t len = 0;
+    while (value >= 0x80) {
+      bytes[len++] = static_cast<char>(value | 0x80);
+      value >>= 7;
+    }
+    bytes[len++] = static_cast<char>(value);
+    buf->sputn(bytes, len);
+  }
+
+  // Ascending integer keys in options.key_encoding, see KeyEncoding
+  template <class T>
+  void process_keys(const std::vector<T>& keys)
+  {
+    using U = std::make_unsigned_t<T>;
+    if (options.key_encoding == KeyEncoding::delta) {
+      U prev = 0;
+      for (size_t i = 0; i < keys.size(); i++) {
+        U cur = static_cast<U>(keys[i]);
+        if (i == 0 && std::is_signed_v<T>) {
+          // Zigzag, so small negative first keys stay short
+          using S = std::make_signed_t<T>;
+          U sign =
+              static_cast<U>(static_cast<S>(keys[0]) >> (8 * sizeof(T) - 1));
+          write_varint(U(U(cur << 1) ^ sign));
+        } else {
+          write_varint(U(cur - prev)); // Gap, the first one is from 0
+        }
+        prev = cur;
+      }
+      return;
+    }
+    uint32_t offsets[detail::pack_block];
+    uint32_t words[detail::pack_block];
+    for (size_t start = 0; start < keys.size(); start += detail::pack_block) {
+      size_t cnt = std::min(detail::pack_block, keys.size() - start);
+      U base = static_cast<U>(keys[start]);
+      U range = U(static_cast<U>(keys[start + cnt - 1]) - base);
+      uint8_t width = static_cast<uint8_t>(std::bit_width(range));
+      process(keys[start]);
+      process(width);
+      if (width <= 32) {
+        std::fill(offsets, offsets + detail::pack_block, 0u);
+        for (size_t i = 0; i < cnt; i++) {
+          offsets[i] = static_cast<uint32_t>(U(keys[start + i]) - base);
+        }
+        detail::pack128(offsets, width, words);
+        buf->sputn(reinterpret_cast<const char*>(words),
+                   4 * width * sizeof(uint32_t));
+      } else { // Too sparse to pack, plain 64 bit offsets
+        for (size_t i = 0; i < cnt; i++) {
+          process(uint64_t(U(keys[start + i]) - base));
+        }
+      }
+    }
+  }
+
+  void add_stages()
+  {
+    // Stages: serializer -> compression -> checksum -> file
+    if (options.framed) {
+      frame = std::make_unique<FrameWriter>(buf, options.chunk_size);
+      buf = frame.get();
+    }
+    if (options.codec) {
+      compress = std::make_unique<CompressWriter>(
+          buf, options.codec, options.block_size, options.threads);
+      buf = compress.get();
+    }
+  }
+
+  BinaryOptions options;
+  std::string file_name;
+  std::filebuf file;                        // Target file, only opened by name
+  std::unique_ptr<AsyncFileWriter> async;   // Instead of file with async_io
+  std::unique_ptr<FrameWriter> frame;       // Checksum stage in framed mode
+  std::unique_ptr<CompressWriter> compress; // Compression stage
+  std::streambuf* buf;                      // Where the bytes actually go
+  bool closed = false;
+  // Ids of strings already written in string table mode
+  std::unordered_map<std::string, size_t, StringHash, std::equal_to<>>
+      string_ids;
+  Traversal::SharedObjects shared; // Objects behind shared pointers
+};
+
+// Input stage handing out at most limit bytes of the source, so a part of
+// an archive can be decoded on its own and checked against its size
+class LimitedReader : public std::streambuf {
+public:
+  LimitedReader(std::streambuf* source, size_t limit)
+      : source(source), left(limit)
+  {
+  }
+
+  size_t remaining() const { return left; }
+
+protected:
+  std::streamsize xsgetn(char* s, std::streamsize n) override
+  {
+    n = static_cast<std::streamsize>(std::min<size_t>(n, left));
+    std::streamsize got = source->sgetn(s, n);
+    left -= got;
+    return got;
+  }
+  int_type underflow() override
+  {
+    return left == 0 ? traits_type::eof() : source->sgetc();
+  }
+  int_type uflow() override
+  {
+    if (left == 0) {
+      return traits_type::eof();
+    }
+    int_type ch = source->sbumpc();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      left--;
+    }
+    return ch;
+  }
+
+private:
+  std::streambuf* source;
+  size_t left;
+};
+
+class BinaryDeserializer {
+public:
+  BinaryDeserializer(const std::string& file_name,
+                     const BinaryOptions& options = {})
+      : options(options), buf(&file)
+  {
+    // Load mode: open target file and throw execption if failed.
+#ifdef MY_SERIALIZER_HAS_PREAD
+    if (options.async_io || options.direct_io || options.pipelined) {
+      async = std::make_unique<AsyncFileReader>(file_name, options.io_chunk,
+                                                options.io_depth,
+                                                options.direct_io,
+                                                options.pipelined);
+      buf = async.get();
+    }
+#endif
+    if (!async) {
+      file.open(file_name, std::ios::binary | std::ios::in);
+      if (!file.is_open()) {
+        throw MyErr("BinarySerializer: Failed to open target file");
+      }
+    }
+    add_stages();
+  }
+  // Read from any stream buffer instead of a file (memory, filter stages...)
+  // The buffer is not owned and has to outlive the deserializer
+  explicit BinaryDeserializer(std::streambuf* source,
+                              const BinaryOptions& options = {})
+      : options(options), buf(source)
+  {
+    add_stages();
+  }
+  ~BinaryDeserializer()
+  {
+    if (file.is_open())
+      file.close();
+  }
+
+  // Load a single column of a columnar vector<T> and skip all others
+  template <class T, class F>
+  void process_column(std::vector<F>& column, F T::*member)
+  {
+    size_t len;
+    process(len);
+    column.resize(len);
+    bool found = false;
+    std::apply(
+        [&](auto... field) {
+          auto visit = [&](auto field) {
+            size_t bytes;
+            process(bytes);
+            if constexpr (std::is_same_v<decltype(field), F T::*>) {
+              if (!found && field == member) {
+                found = true;
+                if constexpr (std::is_same_v<F, bool>) {
+                  auto values = std::make_unique_for_overwrite<bool[]>(len);
+                  read_checked(values.get(), len, bytes);
+                  std::copy(values.get(), values.get() + len, column.begin());
+                } else if constexpr (std::is_arithmetic<F>::value) {
+                  read_checked(column.data(), len * sizeof(F), bytes);
+                } else {
+                  read_column(bytes, column.begin(), column.end(),
+                              [](F& value) -> F& { return value; });
+                }
+                return;
+              }
+            }
+            skip(bytes);
+          };
+          (visit(field), ...);
+        },
+        UserFields<T>::members());
+    if (!found) {
+      throw MyErr("BinaryDeserializer: Member is not a serialized field");
+    }
+  }
+
+  // Check the integrity of the whole archive after loading
+  void finish()
+  {
+    if (compress)
+      compress->finish();
+    if (frame)
+      frame->finish();
+  }
+
+  // Common asset for external call
+  template <class T>
+  void process(T& data)
+  {
+    value(data);
+  }
+
+  // Archive hooks, see Traversal and BinarySerializer
+  static constexpr bool loading = true;
+
+  // Basic types: arithmetic & string
+  // Template only accepts arithmatic types
+  template <class T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+  void leaf(T& data)
+  {
+    // Read data from file
+    read(reinterpret_cast<char*>(&data), sizeof(data));
+  }
+  // String, with any allocator
+  template <class Alloc>
+  void leaf(std::basic_string<char, std::char_traits<char>, Alloc>& data)
+  {
+    if (options.string_table) {
+      data.assign(process_ref());
+      return;
+    }
+    size_t len;
+    leaf(len); // Read in len
+    data.resize(len);
+    read(data.data(), len);
+  }
+  // String view, points into options.strings
+  void leaf(std::string_view& data)
+  {
+    if (!options.strings) {
+      throw MyErr("BinaryDeserializer: Loading std::string_view requires "
+                  "BinaryOptions::strings");
+    }
+    if (options.string_table) {
+      data = process_ref();
+      return;
+    }
+    size_t len;
+    leaf(len);
+    scratch.resize(len);
+    read(scratch.data(), len);
+    data = options.strings->intern(scratch);
+  }
+  size_t begin_sequence(const char*, size_t)
+  {
+    size_t len; // Read in the lenth
+    leaf(len);
+    return len;
+  }
+  void end_sequence() {}
+  void begin_object(const char*) {}
+  void end_object() {}
+  void begin_item(const char*) {}
+  void end_item() {}
+  Traversal::SharedObjects& shared_objects() { return shared; }
+
+  // Nested data, every type not listed below goes through Traversal
+  template <class T>
+  void value(T& data)
+  {
+    Traversal::traverse(*this, data);
+  }
+  // Vector
+  template <class T>
+  void value(std::vector<T>& data)
+  {
+    if constexpr (Traversal::has_members<T>) {
+      if (options.columnar) {
+        process_columns(data);
+        return;
+      }
+    }
+    if constexpr (std::is_floating_point_v<T>) {
+      if (options.float_encoding == FloatEncoding::gorilla) {
+        process_gorilla(data);
+        return;
+      }
+    }
+    if constexpr (is_int_key<T>) {
+      if (options.pack_integers) {
+        process_packed(data);
+        return;
+      }
+    }
+    Traversal::traverse(*this, data);
+  }
+  template <class T>
+  void value(FloatSeries<T>& data)
+  {
+    process_gorilla(data);
+  }
+  // Vector of bool, see BinarySerializer
+  void value(std::vector<bool>& data)
+  {
+    size_t len;
+    process(len);
+    scratch.resize((len + 7) / 8);
+    read(scratch.data(), scratch.size());
+    data.assign(len, false);
+    for (size_t i = 0; i < len; i++) {
+      data[i] = (scratch[i / 8] >> (i % 8)) & 1;
+    }
+  }
+  // Bitset
+  template <size_t N>
+  void value(std::bitset<N>& data)
+  {
+    char bytes[(N + 7) / 8 + 1];
+    read(bytes, (N + 7) / 8);
+    for (size_t i = 0; i < N; i++) {
+      data[i] = (bytes[i / 8] >> (i % 8)) & 1;
+    }
+  }
+  // Set, with any allocator
+  template <class T, class Alloc>
+  void value(std::set<T, std::less<T>, Alloc>& data)
+  {
+    if constexpr (is_int_key<T>) {
+      if (options.key_encoding != KeyEncoding::raw) {
+        size_t len;
+        process(len);
+        data.clear();
+        for (T key : process_keys<T>(len)) {
+          data.emplace_hint(data.end(), key); // Sorted: O(1) insertion
+        }
+        return;
+      }
+    }
+    Traversal::traverse(*this, data);
+  }
+  // Map, with any allocator
+  // Mapped values are allocated like the map's own (see Describe::make)
+  template <class T1, class T2, class Alloc>
+  void value(std::map<T1, T2, std::less<T1>, Alloc>& data)
+  {
+    if constexpr (is_int_key<T1>) {
+      if (options.key_encoding != KeyEncoding::raw) {
+        size_t len;
+        process(len);
+        data.clear();
+        for (T1 key : process_keys<T1>(len)) {
+          auto mapped = Traversal::Describe::make<T2>(data);
+          process(mapped);
+          data.emplace_hint(data.end(), key, std::move(mapped));
+        }
+        return;
+      }
+    }
+    Traversal::traverse(*this, data);
+  }
+
+private:
+  friend struct Patch;
+
+  void add_stages()
+  {
+    // Stages: file -> checksum -> decompression -> deserializer
+    if (options.framed) {
+      frame = std::make_unique<FrameReader>(buf);
+      buf = frame.get();
+    }
+    if (options.codec) {
+      compress = std::make_unique<CompressReader>(buf, options.codec,
+                                                  options.block_size);
+      buf = compress.get();
+    }
+  }
+
+  // Reading past the end of data means the file is truncated or corrupted
+  void read(char* dst, size_t len)
+  {
+    if (static_cast<size_t>(buf->sgetn(dst, len)) != len) {
+      throw MyErr("BinaryDeserializer: Unexpected end of data");
+    }
+  }
+  // Bulk read of a block whose recorded size has to match
+  template <class F>
+  void read_checked(F* dst, size_t len, size_t recorded)
+  {
+    if (len != recorded) {
+      throw MyErr("BinaryDeserializer: Corrupted column");
+    }
+    read(reinterpret_cast<char*>(dst), len);
+  }
+  void skip(size_t len)
+  {
+    char scratch[4096];
+    while (len > 0) {
+      size_t step = std::min(len, sizeof(scratch));
+      read(scratch, step);
+      len -= step;
+    }
+  }
+
+  // String table, see BinarySerializer::process_ref()
+  // Every distinct string is read once and kept in the arena
+  std::string_view process_ref()
+  {
+    uint64_t tag = read_varint();
+    if (tag & 1) {
+      if ((tag >> 1) >= string_table.size()) {
+        throw MyErr("BinaryDeserializer: Corrupted string reference");
+      }
+      return string_table[tag >> 1];
+    }
+    if (!options.strings) {
+      options.strings = std::make_shared<StringArena>(options.resource);
+    }
+    scratch.resize(tag >> 1);
+    read(scratch.data(), scratch.size());
+    string_table.push_back(options.strings->intern(scratch));
+    return string_table.back();
+  }
+
+  BinaryOptions column_options() const
+  {
+    BinaryOptions result = options;
+    result.framed = false;
+    result.codec = nullptr;
+    return result;
+  }
+
+  // See BinarySerializer::process_gorilla()
+  template <class T>
+  void process_gorilla(std::vector<T>& data)
+  {
+    size_t len, bytes;
+    process(len);
+    process(bytes);
+    scratch.resize(bytes);
+    read(scratch.data(), bytes);
+    data.resize(len);
+    detail::gorilla_decode(scratch.data(), bytes, data.data(), len);
+  }
+
+  // See BinarySerializer::process_packed()
+  template <class T>
+  void process_packed(std::vector<T>& data)
+  {
+    using U = std::make_unsigned_t<T>;
+    size_t len;
+    process(len);
+    data.resize(len);
+    if (len == 0) {
+      return;
+    }
+    T base;
+    uint8_t width;
+    process(base);
+    process(width);
+    if (width > 64) {
+      throw MyErr("BinaryDeserializer: Corrupted packed vector");
+    }
+    alignas(16) uint32_t words[detail::pack_block];
+    alignas(16) uint32_t offsets[detail::pack_block];
+    for (size_t start = 0; start < len; start += detail::pack_block) {
+      size_t cnt = std::min(detail::pack_block, len - start);
+      if (width <= 32) {
+        read(reinterpret_cast<char*>(words), 4 * width * sizeof(uint32_t));
+        detail::unpack128(words, width, offsets);
+        for (size_t i = 0; i < cnt; i++) {
+          data[start + i] = static_cast<T>(U(U(base) + offsets[i]));
+        }
+      } else {
+        for (size_t i = 0; i < cnt; i++) {
+          uint64_t offset;
+          process(offset);
+          data[start + i] = static_cast<T>(U(U(base) + offset));
+        }
+      }
+    }
+  }
+
+  uint64_t read_varint()
+  {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      int byte = buf->sbumpc();
+      if (byte == std::streambuf::traits_type::eof()) {
+        throw MyErr("BinaryDeserializer: Unexpected end of data");
+      }
+      value |= uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    throw MyErr("BinaryDeserializer: Corrupted varint");
+  }
+
+  // Ascending integer keys, see BinarySerializer::process_keys()
+  template <class T>
+  std::vector<T> process_keys(size_t len)
+  {
+    using U = std::make_unsigned_t<T>;
+    std::vector<T> keys(len);
+    if (options.key_encoding == KeyEncoding::delta) {
+      U prev = 0;
+      for (size_t i = 0; i < len; i++) {
+        U raw = static_cast<U>(read_varint());
+        if (i == 0 && std::is_signed_v<T>) {
+          prev = U(raw >> 1) ^ U(0 - (raw & 1)); // Undo zigzag
+        } else {
+          prev = U(prev + raw);
+        }
+        keys[i] = static_cast<T>(prev);
+      }
+      return keys;
+    }
+    alignas(16) uint32_t words[detail::pack_block];
+    alignas(16) uint32_t offsets[detail::pack_block];
+    for (size_t start = 0; start < len; start += detail::pack_block) {
+      size_t cnt = std::min(detail::pack_block, len - start);
+      T base;
+      uint8_t width;
+      process(base);
+      process(width);
+      if (width <= 32) {
+        read(reinterpret_cast<char*>(words), 4 * width * sizeof(uint32_t));
+        detail::unpack128(words, width, offsets);
+        for (size_t i = 0; i < cnt; i++) {
+          keys[start + i] = static_cast<T>(U(U(base) + offsets[i]));
+        }
+      } else if (width <= 64) {
+        for (size_t i = 0; i < cnt; i++) {
+          uint64_t offset;
+          process(offset);
+          keys[start + i] = static_cast<T>(U(U(base) + offset));
+        }
+      } else {
+        throw MyErr("BinaryDeserializer: Corrupted key block");
+      }
+    }
+    return keys;
+  }
+
+  // Decode the values of an encoded column of recorded bytes into
+  // get(item) for every item, which has to use up exactly those bytes
+  template <class It, class Get>
+  void read_column(size_t bytes, It begin, It end, Get get)
+  {
+    LimitedReader column(buf, bytes);
+    {
+      BinaryDeserializer column_processor(&column, column_options());
+      for (; begin != end; ++begin) {
+        column_processor.process(get(*begin));
+      }
+    }
+    if (column.remaining() != 0) {
+      throw MyErr("BinaryDeserializer: Corrupted column");
+    }
+  }
+
+  // Columnar layout of vector<T>, see BinarySerializer::process_columns()
+  // Columns are decoded one after another and scattered into the objects
+  template <class T>
+  void process_columns(std::vector<T>& data)
+  {
+    size_t len;
+    process(len);
+    data.clear();
+    data.resize(len);
+    std::apply(
+        [&](auto... member) {
+          auto visit = [&](auto member) {
+            using F = std::remove_reference_t<decltype(data[0].*member)>;
+            size_t bytes;
+            process(bytes);
+            if constexpr (std::is_arithmetic<F>::value) {
+              auto values = std::make_unique_for_overwrite<F[]>(len);
+              read_checked(values.get(), len * sizeof(F), bytes);
+              for (size_t i = 0; i < len; i++) {
+                data[i].*member = values[i];
+              }
+            } else {
+              read_column(bytes, data.begin(), data.end(),
+                          [member](T& value) -> F& { return value.*member; });
+            }
+          };
+          (visit(member), ...);
+        },
+        UserFields<T>::members());
+  }
+
+  BinaryOptions options;
+  std::filebuf file;                        // Target file, only opened by name
+  std::unique_ptr<AsyncFileReader> async;   // Instead of file with async_io
+  std::unique_ptr<FrameReader> frame;       // Checksum stage in framed mode
+  std::unique_ptr<CompressReader> compress; // Decompression stage
+  std::streambuf* buf; // Where the bytes actually come from
+  std::vector<std::string_view> string_table; // Strings by id, in the arena
+  std::string scratch;                        // Reused read buffer
+  Traversal::SharedObjects shared; // Objects behind shared pointers
+};
+
+// Read-only stream buffer over a block of memory, lets BinaryDeserializer
+// decode straight from a mapped file or any other in-memory image
+class MemoryBuffer : public std::streambuf {
+public:
+  MemoryBuffer(const char* data, size_t size)
+  {
+    char* begin = const_cast<char*>(data); // Never written through
+    setg(begin, begin, begin + size);
+  }
+
+  // Current read offset from the start of the block
+  size_t offset() const { return gptr() - eback(); }
+
+protected:
+  std::streamsize xsgetn(char* s, std::streamsize n) override
+  {
+    n = std::min<std::streamsize>(n, egptr() - gptr());
+    std::memcpy(s, gptr(), n);
+    setg(eback(), gptr() + n, egptr()); // gbump() takes an int
+    return n;
+  }
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override
+  {
+    if (dir == std::ios_base::cur) {
+      off += gptr() - eback();
+    } else if (dir == std::ios_base::end) {
+      off += egptr() - eback();
+    }
+    return seekpos(off, which);
+  }
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+  {
+    off_type off = pos;
+    if (!(which & std::ios_base::in) || off < 0 || off > egptr() - eback()) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), eback() + off, egptr());
+    return pos;
+  }
+};
+
+// Stream buffer writing into a fixed block of memory
+// Writing past the end fails instead of reallocating
+class FixedBuffer : public std::streambuf {
+public:
+  FixedBuffer(char* data, size_t size)
+      : begin(data), next(data), end(data + size)
+  {
+  }
+
+  size_t written() const { return next - begin; }
+
+protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override
+  {
+    n = std::min<std::streamsize>(n, end - next);
+    std::memcpy(next, s, n);
+    next += n;
+    return n;
+  }
+  int_type overflow(int_type ch) override
+  {
+    if (next == end || traits_type::eq_int_type(ch, traits_type::eof())) {
+      return traits_type::eof();
+    }
+    *next++ = traits_type::to_char_type(ch);
+    return ch;
+  }
+
+private:
+  char* begin;
+  char* next;
+  char* end;
+};
+
+// Stream buffer that only counts the bytes written to it
+class CountingBuffer : public std::streambuf {
+public:
+  size_t count() const { return cnt; }
+
+protected:
+  std::streamsize xsputn(const char*, std::streamsize n) override
+  {
+    cnt += n;
+    return n;
+  }
+  int_type overflow(int_type ch) override
+  {
+    cnt++;
+    return traits_type::not_eof(ch);
+  }
+
+private:
+  size_t cnt = 0;
+};
+
+// Stream buffer appending to a vector, which grows as needed
+class VectorBuffer : public std::streambuf {
+public:
+  explicit VectorBuffer(std::vector<char>& bytes) : bytes(bytes) {}
+
+protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override
+  {
+    bytes.insert(bytes.end(), s, s + n);
+    return n;
+  }
+  int_type overflow(int_type ch) override
+  {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      bytes.push_back(traits_type::to_char_type(ch));
+    }
+    return traits_type::not_eof(ch);
+  }
+
+private:
+  std::vector<char>& bytes;
+};
+
+// Serialized size of types whose encoding always has the same length with
+// the plain encoding, 0 for all other types
+template <class T, class = void>
+struct fixed_size : std::integral_constant<size_t, 0> {};
+
+template <class T>
+constexpr size_t fixed_size_v = fixed_size<T>::value;
+
+template <class T>
+struct fixed_size<T, std::enable_if_t<std::is_arithmetic_v<T>>>
+    : std::integral_constant<size_t, sizeof(T)> {};
+
+template <class T1, class T2>
+struct fixed_size<std::pair<T1, T2>>
+    : std::integral_constant<size_t, fixed_size_v<T1> && fixed_size_v<T2>
+                                         ? fixed_size_v<T1> + fixed_size_v<T2>
+                                         : 0> {};
+
+template <size_t N>
+struct fixed_size<std::bitset<N>>
+    : std::integral_constant<size_t, (N + 7) / 8> {};
+
+// Fixed extent, no length is stored
+template <class T, size_t N>
+struct fixed_size<std::array<T, N>>
+    : std::integral_constant<size_t, N * fixed_size_v<T>> {};
+
+template <class T, size_t N>
+struct fixed_size<T[N]> : std::integral_constant<size_t, N * fixed_size_v<T>> {
+};
+
+template <class... T>
+struct fixed_size<std::tuple<T...>>
+    : std::integral_constant<size_t, ((fixed_size_v<T> != 0) && ...)
+                                         ? (fixed_size_v<T> + ... + 0)
+                                         : 0> {};
+
+namespace detail {
+template <class Tuple>
+struct fields_fixed_size;
+template <class... F>
+struct fields_fixed_size<std::tuple<F&...>>
+    : std::integral_constant<
+          size_t, ((fixed_size_v<std::remove_cv_t<F>> != 0) && ...)
+                      ? (fixed_size_v<std::remove_cv_t<F>> + ...)
+                      : 0> {};
+} // namespace detail
+
+template <class T>
+struct fixed_size<T, std::enable_if_t<UserFields<T>::value>>
+    : detail::fields_fixed_size<decltype(UserFields<T>::fields(
+          std::declval<T&>()))> {};
+
+// Computes the size BinarySerializer produces with the plain encoding
+// (BinaryOptions::plain()) by walking the data without encoding it
+// Containers of fixed-size types are O(1)
+class SizeCounter {
+public:
+  template <class T>
+  constexpr void process(const T& data)
+  {
+    value(data);
+  }
+
+  // Archive hooks, see Traversal
+  static constexpr bool loading = false;
+
+  template <class T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+  constexpr void leaf(const T&)
+  {
+    size += sizeof(T);
+  }
+  constexpr void leaf(std::string_view data)
+  {
+    size += sizeof(size_t) + data.size();
+  }
+  constexpr size_t begin_sequence(const char*, size_t len)
+  {
+    size += sizeof(size_t);
+    return len;
+  }
+  constexpr void end_sequence() {}
+  constexpr void begin_object(const char*) {}
+  constexpr void end_object() {}
+  constexpr void begin_item(const char*) {}
+  constexpr void end_item() {}
+  Traversal::SharedObjects& shared_objects() { return shared; }
+
+  template <class T>
+  constexpr void value(const T& data)
+  {
+    if constexpr (fixed_size_v<T> != 0) {
+      size += fixed_size_v<T>;
+    } else if constexpr (fixed_range<T>) {
+      size += sizeof(size_t) + data.size() * fixed_size_v<element<T>>;
+    } else {
+      Traversal::traverse(*this, data);
+    }
+  }
+  template <class T>
+  void value(const FloatSeries<T>& data)
+  {
+    std::vector<char> encoded; // Only known by encoding
+    detail::gorilla_encode(data.data(), data.size(), encoded);
+    size += 2 * sizeof(size_t) + encoded.size();
+  }
+  constexpr void value(const std::vector<bool>& data)
+  {
+    size += sizeof(size_t) + (data.size() + 7) / 8;
+  }
+
+  size_t size = 0;
+
+private:
+  template <class T>
+  using element = std::remove_cv_t<typename T::value_type>;
+  // Container of fixed-size elements: length, then the elements
+  template <class T>
+  static constexpr bool fixed_range = [] {
+    if constexpr (Traversal::sized_range<T>) {
+      return fixed_size_v<element<T>> != 0;
+    } else {
+      return false;
+    }
+  }();
+
+  Traversal::SharedObjects shared; // Shared objects are counted once
+};
+
+// Exact number of bytes serialize() writes for data with default options
+// A constant expression for fixed-size types
+template <class T>
+constexpr size_t serialized_size(const T& data)
+{
+  if constexpr (fixed_size_v<T> != 0) {
+    return fixed_size_v<T>;
+  } else {
+    SizeCounter counter;
+    counter.process(data);
+    return counter.size;
+  }
+}
+
+// Exact number of bytes serialize() writes for data with these options
+// Options other than the plain encoding need an encoding pass to know
+template <class T>
+size_t serialized_size(const T& data, const BinaryOptions& options)
+{
+  if (options.plain()) {
+    return serialized_size(data);
+  }
+  CountingBuffer counter;
+  {
+    BinarySerializer processor(&counter, options);
+    processor.process(data);
+  } // Flushes the stages
+  return counter.count();
+}
+
+// Serialize into memory, encoding the data once
+// With plain options the buffer is allocated once at its exact size (sizing
+// does not encode), otherwise it grows while encoding
+template <class T>
+std::vector<char> serialize_to_memory(const T& data,
+                                      const BinaryOptions& options = {})
+{
+  if (!options.plain()) {
+    std::vector<char> bytes;
+    VectorBuffer target(bytes);
+    {
+      BinarySerializer processor(&target, options);
+      processor.process(data);
+    }
+    return bytes;
+  }
+  std::vector<char> bytes(serialized_size(data));
+  FixedBuffer target(bytes.data(), bytes.size());
+  {
+    BinarySerializer processor(&target, options);
+    processor.process(data);
+  }
+  if (target.written() != bytes.size()) {
+    throw MyErr("serialize_to_memory: Size mismatch");
+  }
+  return bytes;
+}
+
+// Hash and size of the bytes of a file, kept in file_name + ".hash" for
+// options.skip_unchanged
+// Every write path of this library removes the sidecar before the file
+// changes (FileIO::drop_fingerprint), only skip_unchanged saves write it
+struct Fingerprint {
+  uint64_t hash = 0;
+  uint64_t size = 0;
+
+  static std::string sidecar(const std::string& file_name)
+  {
+    return FileIO::fingerprint_name(file_name);
+  }
+
+  // True if the file has this size and its sidecar holds this fingerprint
+  // The content of the file is trusted, not read
+  bool matches(const std::string& file_name) const
+  {
+    Fingerprint stored;
+    std::ifstream in(sidecar(file_name), std::ios::binary);
+    std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+    return in.read(reinterpret_cast<char*>(&stored), sizeof(stored)) &&
+           file && uint64_t(file.tellg()) == size && stored.hash == hash &&
+           stored.size == size;
+  }
+  // Written after the file (or staged with it for atomic saves), and the old
+  // one removed before the file is rewritten (or replaced), so a stale
+  // sidecar never vouches for a half-written file
+  void store(const std::string& sidecar_name) const
+  {
+    std::ofstream out(sidecar_name, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(this), sizeof(*this));
+    out.close();
+    if (out.fail()) {
+      throw MyErr("Fingerprint: Cannot write " + sidecar_name);
+    }
+  }
+  static void remove(const std::string& file_name)
+  {
+    FileIO::drop_fingerprint(file_name);
+  }
+};
+
+// Write bytes already encoded with options (serialize_to_memory) to a file,
+// with the file handling of serialize(): atomic, skip_unchanged, preallocate
+// and the async_io modes
+inline bool write_encoded(const std::vector<char>& bytes,
+                          const std::string& file_name,
+                          const BinaryOptions& options = {})
+{
+  Fingerprint fingerprint;
+  if (options.skip_unchanged) {
+    ContentHash hash;
+    hash.update(bytes.data(), bytes.size());
+    fingerprint = {hash.digest(), bytes.size()};
+    if (fingerprint.matches(file_name)) {
+      return false;
+    }
+  }
+  // The old sidecar is removed by the serializer, or by the commit if atomic
+  // Only the file handling, the bytes went through the stages already
+  BinaryOptions file_options;
+  file_options.async_io = options.async_io;
+  file_options.io_depth = options.io_depth;
+  file_options.io_chunk = options.io_chunk;
+  file_options.direct_io = options.direct_io;
+  file_options.pipelined = options.pipelined;
+  FileIO::SaveBatch batch;
+  {
+    BinarySerializer processor(
+        options.atomic ? batch.stage(file_name) : file_name, file_options);
+    if (options.preallocate) {
+      processor.reserve(bytes.size());
+    }
+    processor.write_encoded(bytes.data(), bytes.size());
+    processor.close();
+  }
+  if (options.skip_unchanged && options.atomic) {
+    fingerprint.store(batch.stage(Fingerprint::sidecar(file_name)));
+  }
+  batch.commit();
+  if (options.skip_unchanged && !options.atomic) {
+    fingerprint.store(Fingerprint::sidecar(file_name));
+  }
+  return true;
+}
+
+// Top functions for serialization & deserialization
+// Returns false if the write was skipped (options.skip_unchanged)
+template <class T>
+bool serialize(const T& data, const std::string& file_name,
+               const BinaryOptions& options = {})
+{
+  Fingerprint fingerprint;
+  if (options.skip_unchanged) {
+    // Hashing pass without any output, the data is only encoded again into
+    // the file if its fingerprint changed
+    HashWriter hasher;
+    {
+      BinarySerializer processor(&hasher, options);
+      processor.process(data);
+      processor.close();
+    }
+    hasher.finish();
+    fingerprint = {hasher.digest(), hasher.count()};
+    if (fingerprint.matches(file_name)) {
+      return false;
+    }
+  } else if (options.preallocate && !options.plain()) {
+    // Encoded once into memory, the size needs an encoding pass anyway
+    return write_encoded(serialize_to_memory(data, options), file_name,
+                         options);
+  }
+  FileIO::SaveBatch batch;
+  {
+    BinarySerializer processor(
+        options.atomic ? batch.stage(file_name) : file_name, options);
+    if (options.preallocate) {
+      processor.reserve(options.skip_unchanged
+                            ? fingerprint.size
+                            : serialized_size(data, options));
+    }
+    processor.process(data);
+    processor.close();
+  }
+  if (options.skip_unchanged && options.atomic) {
+    fingerprint.store(batch.stage(Fingerprint::sidecar(file_name)));
+  }
+  batch.commit();
+  if (options.skip_unchanged && !options.atomic) {
+    fingerprint.store(Fingerprint::sidecar(file_name));
+  }
+  return true;
+}
+
+template <class T>
+void deserialize(T& data, const std::string& file_name,
+                 const BinaryOptions& options = {})
+{
+  BinaryDeserializer processor(file_name, options);
+  processor.process(data);
+  processor.finish();
+}
+
+// Load one field of a vector<T> saved with options.columnar, other columns
+// are skipped without being decoded
+template <class T, class F>
+void deserialize_column(std::vector<F>& column, F T::*member,
+                        const std::string& file_name,
+                        const BinaryOptions& options = {})
+{
+  BinaryDeserializer processor(file_name, options);
+  processor.process_column(column, member);
+  processor.finish();
+}
+
+template <class T>
+void deserialize_from_memory(T& data, const char* bytes, size_t len,
+                             const BinaryOptions& options = {})
+{
+  MemoryBuffer source(bytes, len);
+  BinaryDeserializer processor(&source, options);
+  processor.process(data);
+  processor.finish();
+}
+
+// Thread writing encoded archives to their files, in submission order
+// At most max_pending writes wait in the queue, submitting more blocks the
+// caller until the thread catches up. The destructor finishes every write
+// Callbacks run on the writer thread. Writes they submit skip the limit
+// instead of waiting for the thread itself; an exception they throw is
+// kept and thrown by the next write() call
+class BackgroundWriter {
+public:
+  // Called with the error of the write, or nullptr on success
+  using Callback = std::function<void(std::exception_ptr)>;
+
+  explicit BackgroundWriter(size_t max_pending = 8)
+      : max_pending(std::max<size_t>(max_pending, 1)),
+        worker([this] { run(); })
+  {
+  }
+  BackgroundWriter(const BackgroundWriter&) = delete;
+  BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+  ~BackgroundWriter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    not_empty.notify_one();
+    worker.join();
+  }
+
+  void write(std::vector<char> bytes, const std::string& file_name,
+             const BinaryOptions& options, Callback done)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (callback_error) {
+      std::exception_ptr err = callback_error;
+      callback_error = nullptr;
+      std::rethrow_exception(err);
+    }
+    if (std::this_thread::get_id() != worker.get_id()) {
+      not_full.wait(lock, [this] { return jobs.size() < max_pending; });
+    }
+    jobs.push_back(
+        {std::move(bytes), file_name, options, std::move(done)});
+    lock.unlock();
+    not_empty.notify_one();
+  }
+  std::future<void> write(std::vector<char> bytes,
+                          const std::string& file_name,
+                          const BinaryOptions& options = {})
+  {
+    auto promise = std::make_shared<std::promise<void>>();
+    std::future<void> result = promise->get_future();
+    write(std::move(bytes), file_name, options,
+          [promise](std::exception_ptr err) {
+            if (err) {
+              promise->set_exception(err);
+            } else {
+              promise->set_value();
+            }
+          });
+    return result;
+  }
+
+  // Writer used by serialize_async()
+  static BackgroundWriter& shared()
+  {
+    static BackgroundWriter writer;
+    return writer;
+  }
+
+private:
+  struct Job {
+    std::vector<char> bytes;
+    std::string file_name;
+    BinaryOptions options;
+    Callback done;
+  };
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      not_empty.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (jobs.empty()) {
+        return; // Stopping and drained
+      }
+      Job job = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      not_full.notify_one();
+      std::exception_ptr err;
+      try {
+        write_encoded(job.bytes, job.file_name, job.options);
+      } catch (...) {
+        err = std::current_exception();
+      }
+      if (job.done) {
+        try {
+          job.done(err);
+        } catch (...) {
+          lock.lock();
+          if (!callback_error) {
+            callback_error = std::current_exception();
+          }
+          continue;
+        }
+      }
+      lock.lock();
+    }
+  }
+
+  size_t max_pending;
+  std::mutex mutex;
+  std::condition_variable not_empty, not_full;
+  std::deque<Job> jobs;
+  bool stopping = false;
+  std::exception_ptr callback_error; // First one thrown by a callback
+  std::thread worker; // Last, starts once the rest is ready
+};
+
+// Encode on the calling thread, write to the file in the background
+// Encoding errors are thrown right away, write errors through the future
+// (or the callback)
+template <class T>
+std::future<void> serialize_async(const T& data, const std::string& file_name,
+                                  const BinaryOptions& options = {},
+                                  BackgroundWriter& writer =
+                                      BackgroundWriter::shared())
+{
+  return writer.write(serialize_to_memory(data, options), file_name, options);
+}
+
+template <class T>
+void serialize_async(const T& data, const std::string& file_name,
+                     BackgroundWriter::Callback done,
+                     const BinaryOptions& options = {},
+                     BackgroundWriter& writer = BackgroundWriter::shared())
+{
+  writer.write(serialize_to_memory(data, options), file_name, options,
+               std::move(done));
+}
+
+// Append-only log of records written by many threads at once
+// Every thread encodes its record into a buffer of its own, which is handed
+// over in a node; nodes go through a lock-free multi-producer queue to one
+// writer thread that batches them into blocks, then back to the producers
+// through a free list, so appending allocates nothing once warmed up:
+//   block:  payload length, record count, CRC32C of payload (uint32_t each)
+//   record: length (uint32_t), plain binary encoding
+// A crash while appending can only tear the last block, replay() stops there
+// Lengths are 32 bit: a record, with its length, has to fit in a block
+// payload of at most UINT32_MAX bytes
+class RecordLog {
+public:
+  explicit RecordLog(const std::string& file_name, size_t block_size = 1 << 16)
+      : file_name(file_name), block_size(block_size)
+  {
+    if (block_size > UINT32_MAX) {
+      throw MyErr("RecordLog: Invalid block size");
+    }
+    FileIO::drop_fingerprint(file_name);
+    if (!file.open(file_name,
+                   std::ios::binary | std::ios::out | std::ios::app)) {
+      throw MyErr("RecordLog: Failed to open " + file_name);
+    }
+    writer = std::thread([this] { run(); });
+  }
+  RecordLog(const RecordLog&) = delete;
+  RecordLog& operator=(const RecordLog&) = delete;
+  // Writes everything appended before, appending has to be over
+  ~RecordLog()
+  {
+    Node* stop = new Node;
+    stop->kind = Node::stop;
+    push(stop);
+    writer.join();
+  }
+
+  // Safe from any number of threads
+  // Throws MyErr, without queuing anything, if the record is too large
+  template <class T>
+  void append(const T& record)
+  {
+    // Encoding buffer of this thread, its capacity is kept across calls
+    thread_local std::vector<char> bytes;
+    thread_local VectorBuffer target(bytes);
+    bytes.clear();
+    {
+      BinarySerializer processor(&target);
+      processor.process(record);
+    }
+    if (bytes.size() > UINT32_MAX - sizeof(uint32_t)) {
+      std::vector<char>().swap(bytes); // Do not keep the buffer around
+      throw MyErr("RecordLog: Record too large");
+    }
+    Node* node = free_nodes.take();
+    if (!node) {
+      node = new Node;
+    }
+    node->bytes.swap(bytes); // This thread goes on with the node's old buffer
+    push(node);
+  }
+
+  // Wait until every record appended before by this thread is written
+  // (and synced to disk if durable). Throws write errors
+  void flush(bool durable = false)
+  {
+    Node* node = new Node;
+    node->kind = durable ? Node::sync : Node::flush;
+    std::future<void> done = node->done.get_future();
+    push(node);
+    done.get();
+  }
+
+  // Call f with every complete record of a log, in order
+  template <class T, class F>
+  static void replay(const std::string& file_name, F&& f)
+  {
+    std::ifstream in(file_name, std::ios::binary);
+    if (!in) {
+      throw MyErr("RecordLog: Failed to open " + file_name);
+    }
+    std::vector<char> payload;
+    uint32_t header[3];
+    while (in.read(reinterpret_cast<char*>(header), sizeof(header))) {
+      payload.resize(header[0]);
+      if (!in.read(payload.data(), payload.size()) ||
+          crc32c(0, payload.data(), payload.size()) != header[2]) {
+        return; // Torn last block
+      }
+      const char* pos = payload.data();
+      const char* end = pos + payload.size();
+      for (uint32_t i = 0; i < header[1]; i++) {
+        uint32_t len = 0;
+        if (end - pos >= 4) {
+          std::memcpy(&len, pos, 4);
+        }
+        if (end - pos < 4 || static_cast<size_t>(end - pos - 4) < len) {
+          throw MyErr("RecordLog: Corrupted block");
+        }
+        T record;
+        deserialize_from_memory(record, pos + 4, len);
+        f(std::move(record));
+        pos += 4 + len;
+      }
+    }
+  }
+
+private:
+  struct Node {
+    enum Kind { record, flush, sync, stop };
+    std::atomic<Node*> next = nullptr;
+    Kind kind = record;
+    std::vector<char> bytes;
+    std::promise<void> done; // flush and sync
+  };
+
+  // Record nodes the writer is done with, taken again by producers
+  // Bounded lock-free MPMC queue of pointers (Vyukov's), whose sequence
+  // numbers rule out ABA; nodes that do not fit are deleted
+  class FreeNodes {
+  public:
+    FreeNodes()
+    {
+      for (size_t i = 0; i < capacity; i++) {
+        cells[i].seq.store(i, std::memory_order_relaxed);
+      }
+    }
+    ~FreeNodes()
+    {
+      while (Node* node = take()) {
+        delete node;
+      }
+    }
+
+    // Writer only
+    void give(Node* node)
+    {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      Cell& cell = cells[pos % capacity];
+      if (cell.seq.load(std::memory_order_acquire) != pos) {
+        delete node; // Full
+        return;
+      }
+      cell.node = node;
+      tail.store(pos + 1, std::memory_order_relaxed);
+      cell.seq.store(pos + 1, std::memory_order_release);
+    }
+    // Any producer, nullptr if empty
+    Node* take()
+    {
+      size_t pos = head.load(std::memory_order_relaxed);
+      while (true) {
+        Cell& cell = cells[pos % capacity];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        if (seq == pos + 1) {
+          if (head.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+            Node* node = cell.node;
+            cell.seq.store(pos + capacity, std::memory_order_release);
+            return node;
+          }
+        } else if (seq < pos + 1) {
+          return nullptr;
+        } else {
+          pos = head.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+  private:
+    static constexpr size_t capacity = 1024;
+    struct Cell {
+      std::atomic<size_t> seq;
+      Node* node = nullptr;
+    };
+    std::array<Cell, capacity> cells;
+    alignas(64) std::atomic<size_t> head = 0; // Producers
+    alignas(64) std::atomic<size_t> tail = 0; // Writer
+  };
+
+  // Producers: one exchange and one store, never blocked by each other or by
+  // the writer (Vyukov's intrusive MPSC queue)
+  void push(Node* node)
+  {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+    pushes.fetch_add(1, std::memory_order_release);
+    pushes.notify_one();
+  }
+
+  // Writer only, nullptr if empty or a push is halfway
+  Node* pop()
+  {
+    Node* first = tail;
+    Node* next = first->next.load(std::memory_order_acquire);
+    if (first == &stub) {
+      if (!next) {
+        return nullptr;
+      }
+      tail = first = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      tail = next;
+      return first;
+    }
+    if (first != head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    push(&stub); // Keep one node in the queue
+    next = first->next.load(std::memory_order_acquire);
+    if (next) {
+      tail = next;
+      return first;
+    }
+    return nullptr;
+  }
+
+  void run()
+  {
+    while (true) {
+      uint64_t seen = pushes.load(std::memory_order_acquire);
+      Node* node = pop();
+      if (!node) {
+        write_block(); // Queue drained, do not hold records back
+        pushes.wait(seen, std::memory_order_acquire);
+        continue;
+      }
+      if (node->kind == Node::record) {
+        if (block.size() + 4 + node->bytes.size() > block_size) {
+          write_block();
+        }
+        uint32_t len = static_cast<uint32_t>(node->bytes.size());
+        block.insert(block.end(), reinterpret_cast<const char*>(&len),
+                     reinterpret_cast<const char*>(&len) + 4);
+        block.insert(block.end(), node->bytes.begin(), node->bytes.end());
+        count++;
+        if (node->bytes.capacity() > block_size) {
+          delete node; // Do not keep buffers of outsized records around
+        } else {
+          free_nodes.give(node);
+        }
+        continue;
+      }
+      std::unique_ptr<Node> owned(node);
+      write_block();
+      if (node->kind == Node::stop) {
+        return;
+      }
+      try {
+        if (error) {
+          std::rethrow_exception(error);
+        }
+        if (node->kind == Node::sync) {
+          FileIO::detail::sync(file_name);
+        }
+        node->done.set_value();
+      } catch (...) {
+        node->done.set_exception(std::current_exception());
+      }
+    }
+  }
+
+  void write_block()
+  {
+    if (count == 0) {
+      return;
+    }
+    uint32_t header[3] = {static_cast<uint32_t>(block.size()), count,
+                          crc32c(0, block.data(), block.size())};
+    if (!error &&
+        (file.sputn(reinterpret_cast<const char*>(header), sizeof(header)) !=
+             sizeof(header) ||
+         file.sputn(block.data(), block.size()) !=
+             static_cast<std::streamsize>(block.size()) ||
+         file.pubsync() != 0)) {
+      error = std::make_exception_ptr(
+          MyErr("RecordLog: Cannot write " + file_name));
+    }
+    block.clear();
+    count = 0;
+  }
+
+  std::string file_name;
+  size_t block_size;
+  std::filebuf file;
+  // Queue: producers swing head, the writer consumes from tail
+  Node stub;
+  std::atomic<Node*> head = &stub;
+  Node* tail = &stub;
+  std::atomic<uint64_t> pushes = 0; // Wakes the writer
+  FreeNodes free_nodes;
+  // Writer only
+  std::vector<char> block;
+  uint32_t count = 0;
+  std::exception_ptr error; // First write error, reported by flush()
+  std::thread writer;       // Last, starts once the rest is ready
+};
+
+#ifdef MY_SERIALIZER_HAS_MMAP
+// Channel between two processes (or threads) through a POSIX shared memory
+// ring: one sender encodes straight into the ring, one receiver decodes
+// straight out of it, nothing is copied on the way
+// Segment: header, then capacity bytes of messages
+//   message: length (uint32_t), encoded bytes, padding to 8 bytes
+//   a length of wrap_mark sends the reader back to the start of the ring,
+//   so every message is contiguous and can be viewed in place
+// Indices are byte counts that only grow, written by one side each. A side
+// that has to wait sleeps on a futex (Linux) and is woken by the other one
+class SharedRing {
+public:
+  // Create the segment (sender side, usually), removed again by the
+  // destructor of its creator
+  SharedRing(const std::string& name, size_t capacity)
+      : name(name), owner(true)
+  {
+    capacity = (capacity + 7) / 8 * 8;
+    attach(::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600),
+           sizeof(Header) + capacity);
+    new (header) Header();
+    header->capacity = capacity;
+    header->magic.store(ring_magic, std::memory_order_release);
+  }
+  // Attach to a segment created by the other side
+  explicit SharedRing(const std::string& name) : name(name)
+  {
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+    struct stat info;
+    if (fd >= 0 && ::fstat(fd, &info) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+    attach(fd, fd >= 0 ? info.st_size : 0);
+    if (size < sizeof(Header) ||
+        header->magic.load(std::memory_order_acquire) != ring_magic ||
+        sizeof(Header) + header->capacity != size) {
+      release();
+      throw MyErr("SharedRing: Not a ready ring: " + name);
+    }
+  }
+  SharedRing(const SharedRing&) = delete;
+  SharedRing& operator=(const SharedRing&) = delete;
+  ~SharedRing() { release(); }
+
+  // Sender side: wait for room, then encode into the ring
+  template <class T>
+  void send(const T& data, const BinaryOptions& options = {})
+  {
+    // Plain encodings are sized without encoding and then encoded straight
+    // into the ring; other options are encoded once here and copied over
+    bool plain = options.plain();
+    if (!plain) {
+      encoded.clear();
+      VectorBuffer target(encoded);
+      BinarySerializer processor(&target, options);
+      processor.process(data);
+    }
+    size_t len = plain ? serialized_size(data) : encoded.size();
+    size_t need = padded(4 + len);
+    uint64_t capacity = header->capacity;
+    if (need > capacity / 2 || len >= wrap_mark) {
+      throw MyErr("SharedRing: Message larger than half the ring");
+    }
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t pos = head % capacity;
+    uint64_t skip = capacity - pos < need ? capacity - pos : 0;
+    wait_until(header->space, header->sender_waiting, [&] {
+      uint64_t used = head - header->tail.load(std::memory_order_acquire);
+      return capacity - used >= skip + need;
+    });
+    if (skip > 0) {
+      put_u32(pos, wrap_mark);
+      head += skip;
+      pos = 0;
+    }
+    if (plain) {
+      FixedBuffer target(data_at(pos + 4), len);
+      {
+        BinarySerializer processor(&target, options);
+        processor.process(data);
+      }
+      if (target.written() != len) {
+        throw MyErr("SharedRing: Size mismatch");
+      }
+    } else {
+      std::memcpy(data_at(pos + 4), encoded.data(), len);
+    }
+    put_u32(pos, static_cast<uint32_t>(len));
+    publish(header->head, head + need, header->data,
+            header->receiver_waiting);
+  }
+
+  // Receiver side: wait for the next message and decode it from the ring
+  template <class T>
+  void receive(T& data, const BinaryOptions& options = {})
+  {
+    view([&](const char* bytes, size_t len) {
+      deserialize_from_memory(data, bytes, len, options);
+    });
+  }
+
+  // Receiver side: f(bytes, len) on the next message where it lies in the
+  // shared segment, the space is handed back once f returns
+  // If f throws, the message is dropped all the same and the ring goes on
+  template <class F>
+  void view(F&& f)
+  {
+    uint64_t capacity = header->capacity;
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    while (true) {
+      wait_until(header->data, header->receiver_waiting, [&] {
+        return header->head.load(std::memory_order_acquire) != tail;
+      });
+      uint64_t pos = tail % capacity;
+      uint32_t len = get_u32(pos);
+      if (len != wrap_mark) {
+        struct Release {
+          Header* header;
+          uint64_t tail;
+          ~Release()
+          {
+            publish(header->tail, tail, header->space,
+                    header->sender_waiting);
+          }
+        } release{header, tail + padded(4 + len)};
+        f(static_cast<const char*>(data_at(pos + 4)), size_t(len));
+        return;
+      }
+      tail += capacity - pos;
+      publish(header->tail, tail, header->space, header->sender_waiting);
+    }
+  }
+
+private:
+  static constexpr uint32_t ring_magic = 0x5253594d; // "MYSR"
+  static constexpr uint32_t wrap_mark = 0xffffffff;
+
+  // Each side writes its own cache line only
+  struct Header {
+    std::atomic<uint32_t> magic = 0; // Set once the ring is ready
+    uint64_t capacity = 0;
+    alignas(64) std::atomic<uint64_t> head = 0; // Bytes sent
+    std::atomic<uint32_t> data = 0;             // Futex: bumped per send
+    std::atomic<uint32_t> sender_waiting = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0; // Bytes received
+    std::atomic<uint32_t> space = 0;            // Futex: bumped per receive
+    std::atomic<uint32_t> receiver_waiting = 0;
+  };
+  static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                std::atomic<uint32_t>::is_always_lock_free);
+
+  static uint64_t padded(uint64_t len) { return (len + 7) / 8 * 8; }
+  char* data_at(uint64_t pos) const
+  {
+    return reinterpret_cast<char*>(header + 1) + pos;
+  }
+  void put_u32(uint64_t pos, uint32_t value)
+  {
+    std::memcpy(data_at(pos), &value, 4);
+  }
+  uint32_t get_u32(uint64_t pos) const
+  {
+    uint32_t value;
+    std::memcpy(&value, data_at(pos), 4);
+    return value;
+  }
+
+  // Move an index forward, then wake the other side if it sleeps
+  static void publish(std::atomic<uint64_t>& index, uint64_t value,
+                      std::atomic<uint32_t>& futex,
+                      std::atomic<uint32_t>& waiting)
+  {
+    index.store(value, std::memory_order_seq_cst);
+    futex.fetch_add(1, std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_seq_cst)) {
+      wake(futex);
+    }
+  }
+
+  // Sleep on futex until ready() holds. waiting is raised before the last
+  // check, so a publish() after that check always wakes us
+  template <class F>
+  static void wait_until(std::atomic<uint32_t>& futex,
+                         std::atomic<uint32_t>& waiting, F ready)
+  {
+    while (!ready()) {
+      uint32_t seen = futex.load(std::memory_order_seq_cst);
+      waiting.store(1, std::memory_order_seq_cst);
+      if (!ready()) {
+        sleep(futex, seen);
+      }
+      waiting.store(0, std::memory_order_seq_cst);
+    }
+  }
+
+  static void sleep(std::atomic<uint32_t>& futex, uint32_t seen)
+  {
+#ifdef __linux__
+    // Shared futex (no FUTEX_PRIVATE_FLAG): the word lives in shared memory
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&futex), FUTEX_WAIT,
+              seen, nullptr, nullptr, 0);
+#else
+    (void)futex;
+    (void)seen;
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+  }
+  static void wake(std::atomic<uint32_t>& futex)
+  {
+#ifdef __linux__
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&futex), FUTEX_WAKE,
+              INT_MAX, nullptr, nullptr, 0);
+#else
+    (void)futex;
+#endif
+  }
+
+  void attach(int fd, size_t bytes)
+  {
+    if (fd < 0) {
+      throw MyErr("SharedRing: Cannot open " + name);
+    }
+    if (owner && ::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+      ::close(fd);
+      ::shm_unlink(name.c_str());
+      throw MyErr("SharedRing: Cannot size " + name);
+    }
+    void* ptr = bytes > 0 ? ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, fd, 0)
+                          : MAP_FAILED;
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+      if (owner) {
+        ::shm_unlink(name.c_str());
+      }
+      throw MyErr("SharedRing: Cannot map " + name);
+    }
+    header = static_cast<Header*>(ptr);
+    size = bytes;
+  }
+  void release()
+  {
+    if (header) {
+      ::munmap(header, size);
+      header = nullptr;
+    }
+    if (owner) {
+      ::shm_unlink(name.c_str());
+      owner = false;
+    }
+  }
+
+  std::string name;
+  bool owner = false; // Created the segment
+  Header* header = nullptr;
+  size_t size = 0; // Of the mapping
+  std::vector<char> encoded; // Sender: reused for non-plain messages
+};
+#endif
+
+// Patches: what changed in a value since a previous state of it
+// - user-defined types: a bitmask of the changed fields, then their patches
+// - maps and sets: removed keys, added entries, then the keys and patches of
+//   changed values
+// - sequences: new length, indices and patches of changed items, then the
+//   appended items
+// - anything else: the whole new value
+// Counts and indices are varints, values use the plain encoding of the
+// archive (and its options)
+struct Patch {
+  // Structural equality, also for types without operator==
+  template <class T>
+  static bool equal(const T& a, const T& b)
+  {
+    if constexpr (Traversal::associative<T>) {
+      if (a.size() != b.size()) {
+        return false;
+      }
+      for (const auto& value : a) {
+        if constexpr (is_map<T>) {
+          auto it = b.find(value.first);
+          if (it == b.end() || !equal(value.second, it->second)) {
+            return false;
+          }
+        } else if (b.find(value) == b.end()) {
+          return false;
+        }
+      }
+      return true;
+    } else if constexpr (Traversal::sized_range<T>) {
+      return a.size() == b.size() &&
+             std::equal(a.begin(), a.end(), b.begin(),
+                        [](const auto& x, const auto& y) {
+                          return equal(x, y);
+                        });
+    } else if constexpr (Traversal::user_type<T>) {
+      return equal_all(UserFields<T>::fields(a), UserFields<T>::fields(b));
+    } else if constexpr (Traversal::instance_of<T, std::pair>) {
+      return equal(a.first, b.first) && equal(a.second, b.second);
+    } else if constexpr (Traversal::instance_of<T, std::tuple>) {
+      return equal_all(a, b);
+    } else if constexpr (Traversal::instance_of<T, std::optional>) {
+      return a.has_value() == b.has_value() && (!a || equal(*a, *b));
+    } else if constexpr (Traversal::instance_of<T, std::unique_ptr> ||
+                         Traversal::instance_of<T, std::shared_ptr>) {
+      using E = typename T::element_type;
+      if constexpr (std::is_polymorphic_v<E>) {
+        // Same registered type, then the same encoding of the object
+        return a == b ||
+               (a && b &&
+                Traversal::Polymorphic<E>::id_of(*a) ==
+                    Traversal::Polymorphic<E>::id_of(*b) &&
+                serialize_to_memory(a) == serialize_to_memory(b));
+      } else {
+        return a == b || (a && b && equal(*a, *b));
+      }
+    } else {
+      return a == b;
+    }
+  }
+
+  // Changes from old to data, nothing else has to be written
+  template <class T>
+  static void write(BinarySerializer& out, const T& old, const T& data)
+  {
+    if constexpr (Traversal::associative<T> && !is_multi<T>) {
+      std::vector<const typename T::key_type*> removed;
+      for (const auto& value : old) {
+        if (data.find(key_of<T>(value)) == data.end()) {
+          removed.push_back(&key_of<T>(value));
+        }
+      }
+      std::vector<const typename T::value_type*> added, changed;
+      for (const auto& value : data) {
+        auto it = old.find(key_of<T>(value));
+        if (it == old.end()) {
+          added.push_back(&value);
+        } else if constexpr (is_map<T>) {
+          if (!equal(it->second, value.second)) {
+            changed.push_back(&value);
+          }
+        }
+      }
+      out.write_varint(removed.size());
+      for (const auto* key : removed) {
+        out.process(*key);
+      }
+      out.write_varint(added.size());
+      for (const auto* value : added) {
+        out.process(*value);
+      }
+      if constexpr (is_map<T>) {
+        out.write_varint(changed.size());
+        for (const auto* value : changed) {
+          out.process(value->first);
+          write(out, old.find(value->first)->second, value->second);
+        }
+      }
+    } else if constexpr (itemwise<T>) {
+      out.write_varint(data.size());
+      std::vector<std::pair<size_t, const typename T::value_type*>> changed;
+      auto it = old.begin();
+      size_t i = 0;
+      for (const auto& value : data) {
+        if (i == old.size()) {
+          break;
+        }
+        if (!equal(*it, value)) {
+          changed.push_back({i, &*it});
+        }
+        ++it;
+        ++i;
+      }
+      out.write_varint(changed.size());
+      auto now = data.begin();
+      size_t at = 0;
+      for (const auto& [index, before] : changed) {
+        std::advance(now, index - at);
+        at = index;
+        out.write_varint(index);
+        write(out, *before, *now);
+      }
+      for (std::advance(now, i - at); now != data.end(); ++now) {
+        out.process(*now); // Appended
+      }
+    } else if constexpr (Traversal::user_type<T>) {
+      auto before = UserFields<T>::fields(old);
+      auto after = UserFields<T>::fields(data);
+      constexpr size_t n = std::tuple_size_v<decltype(after)>;
+      uint8_t mask[(n + 7) / 8] = {};
+      for_each_field<n>([&](auto i) {
+        if (!equal(std::get<i>(before), std::get<i>(after))) {
+          mask[i / 8] |= uint8_t(1u << (i % 8));
+        }
+      });
+      for (uint8_t byte : mask) {
+        out.process(byte);
+      }
+      for_each_field<n>([&](auto i) {
+        if (mask[i / 8] >> (i % 8) & 1) {
+          write(out, std::get<i>(before), std::get<i>(after));
+        }
+      });
+    } else {
+      out.process(data);
+    }
+  }
+
+  // Applies a patch written by write() to the old state in data
+  template <class T>
+  static void read(BinaryDeserializer& in, T& data)
+  {
+    if constexpr (Traversal::associative<T> && !is_multi<T>) {
+      for (uint64_t n = in.read_varint(); n > 0; n--) {
+        typename T::key_type key;
+        in.process(key);
+        data.erase(key);
+      }
+      for (uint64_t n = in.read_varint(); n > 0; n--) {
+        // Allocated like the entries of data, moved in without a copy
+        if constexpr (is_map<T>) {
+          auto key = Traversal::Describe::make<typename T::key_type>(data);
+          auto value =
+              Traversal::Describe::make<typename T::mapped_type>(data);
+          in.process(key);
+          in.process(value);
+          data.insert_or_assign(std::move(key), std::move(value));
+        } else {
+          auto value = Traversal::Describe::make<typename T::value_type>(data);
+          in.process(value);
+          data.insert(std::move(value));
+        }
+      }
+      if constexpr (is_map<T>) {
+        for (uint64_t n = in.read_varint(); n > 0; n--) {
+          typename T::key_type key;
+          in.process(key);
+          auto it = data.find(key);
+          if (it == data.end()) {
+            throw MyErr("Patch: Changed key not in the base state");
+          }
+          read(in, it->second);
+        }
+      }
+    } else if constexpr (itemwise<T>) {
+      size_t old_len = data.size();
+      size_t len = in.read_varint();
+      data.resize(len);
+      auto it = data.begin();
+      size_t at = 0;
+      for (uint64_t n = in.read_varint(); n > 0; n--) {
+        size_t index = in.read_varint();
+        if (index < at || index >= std::min(old_len, len)) {
+          throw MyErr("Patch: Corrupted item index");
+        }
+        std::advance(it, index - at);
+        at = index;
+        read(in, *it);
+      }
+      if (len > old_len) {
+        for (std::advance(it, old_len - at); it != data.end(); ++it) {
+          in.process(*it);
+        }
+      }
+    } else if constexpr (Traversal::user_type<T>) {
+      auto fields = UserFields<T>::fields(data);
+      constexpr size_t n = std::tuple_size_v<decltype(fields)>;
+      uint8_t mask[(n + 7) / 8];
+      for (uint8_t& byte : mask) {
+        in.process(byte);
+      }
+      for_each_field<n>([&](auto i) {
+        if (mask[i / 8] >> (i % 8) & 1) {
+          read(in, std::get<i>(fields));
+        }
+      });
+    } else {
+      in.process(data);
+    }
+  }
+
+private:
+  template <class T>
+  static constexpr bool is_map = requires { typename T::mapped_type; };
+  // Sequences patched item by item, vector<bool> is written whole
+  template <class T>
+  static constexpr bool itemwise = [] {
+    if constexpr (Traversal::sequence<T>) {
+      return !std::is_same_v<std::ranges::range_value_t<T>, bool>;
+    }
+    return false;
+  }();
+  // Containers with equivalent keys are patched as a whole
+  template <class T>
+  static constexpr bool is_multi = requires(T& data) {
+    { data.insert(*data.begin()) } -> std::same_as<typename T::iterator>;
+  };
+
+  template <class T>
+  static const typename T::key_type& key_of(const typename T::value_type& v)
+  {
+    if constexpr (is_map<T>) {
+      return v.first;
+    } else {
+      return v;
+    }
+  }
+
+  template <class A, class B>
+  static bool equal_all(const A& a, const B& b)
+  {
+    bool same = true;
+    for_each_field<std::tuple_size_v<A>>([&](auto i) {
+      same = same && equal(std::get<i>(a), std::get<i>(b));
+    });
+    return same;
+  }
+
+  // f(std::integral_constant<size_t, i>) for i in [0, n)
+  template <size_t n, class F>
+  static void for_each_field(F f)
+  {
+    [&]<size_t... I>(std::index_sequence<I...>) {
+      (f(std::integral_constant<size_t, I>()), ...);
+    }(std::make_index_sequence<n>());
+  }
 };
 
-namespace BinarySerialize {
+// Write the changes from previous to data, see Patch
+template <class T>
+void serialize_patch(const T& previous, const T& data,
+                     const std::string& file_name,
+                     const BinaryOptions& options = {})
+{
+  BinarySerializer processor(file_name, options);
+  bool changed = !Patch::equal(previous, data);
+  processor.process(changed);
+  if (changed) {
+    Patch::write(processor, previous, data);
+  }
+  processor.close();
+}
 
-class BinarySerializer {
+// Apply a patch written by serialize_patch() to the previous state in data
+template <class T>
+void apply_patch(T& data, const std::string& file_name,
+                 const BinaryOptions& options = {})
+{
+  BinaryDeserializer processor(file_name, options);
+  bool changed = false;
+  processor.process(changed);
+  if (changed) {
+    Patch::read(processor, data);
+  }
+  processor.finish();
+}
+
+// A base snapshot and a chain of patches: prefix.base, prefix.1, prefix.2...
+// Every file starts with the random id of its base, patches also with their
+// position in the chain, so patches left over from an older base are ignored
+// Patches are always framed (CRC32C): load() stops at the first torn or
+// corrupted patch and keeps the state of the chain before it
+// After compact_every patches the next save writes a new base instead
+// A new base is staged and replaced atomically, so a crash never leaves a
+// torn base behind with its chain already removed
+// The last state saved or loaded is kept as a deep copy to diff against,
+// decoded from the base when one is written or loaded, with every patch
+// applied to it since: pointees changed in place are still seen as changes,
+// T does not have to be copyable, and a save only encodes the patch
+template <class T>
+class Checkpoints {
 public:
-  BinarySerializer(const std::string& file_name)
+  Checkpoints(const std::string& prefix, size_t compact_every = 16,
+              const BinaryOptions& options = {})
+      : prefix(prefix), compact_every(compact_every), options(options),
+        patch_options(options), body_options(options)
   {
-    // Save mode: open and clear target file in binary mode, create target
-    // file if not exist
-    file.open(file_name, std::ios::binary | std::ios::out | std::ios::trunc);
+    patch_options.framed = true;
+    body_options.framed = false;
+    body_options.codec = nullptr;
   }
-  ~BinarySerializer()
+
+  // Unchanged states write nothing
+  void save(const T& data)
   {
-    if (file.is_open())
-      file.close();
+    if (!last || patches >= compact_every) {
+      uint64_t next = new_id();
+      {
+        FileIO::SaveBatch batch;
+        BinarySerializer processor(batch.stage(prefix + ".base"), options);
+        processor.process(next);
+        processor.process(data);
+        processor.close();
+        batch.commit();
+      }
+      // The old chain is stale once the new base is complete, including
+      // one left by an earlier process
+      remove_chain(1);
+      base_id = next;
+      patches = 0;
+      tail_checked = true;
+      last.emplace();
+      read_base(*last);
+    } else if (!Patch::equal(*last, data)) {
+      if (!tail_checked) { // Patches past a bad one must not follow ours
+        remove_chain(patches + 1);
+        tail_checked = true;
+      }
+      // Encoded once without stages, then written behind the patch header
+      // and applied to the copy
+      std::vector<char> body;
+      VectorBuffer target(body);
+      {
+        BinarySerializer encoder(&target, body_options);
+        Patch::write(encoder, *last, data);
+      }
+      FileIO::SaveBatch batch;
+      std::string name = patch_name(patches + 1);
+      {
+        BinarySerializer processor(
+            options.atomic ? batch.stage(name) : name, patch_options);
+        processor.process(base_id);
+        processor.process(uint64_t(patches + 1));
+        processor.write_encoded(body.data(), body.size());
+        processor.close();
+      }
+      batch.commit();
+      patches++;
+      MemoryBuffer source(body.data(), body.size());
+      BinaryDeserializer decoder(&source, body_options);
+      Patch::read(decoder, *last);
+    }
   }
 
-  // Key can be ignored in Binary Serialization
+  // The base with every intact patch of its chain applied
+  void load(T& data)
+  {
+    read_chain(data);
+    last.emplace();
+    read_chain(*last);
+    tail_checked = false;
+  }
 
-  // Basic types: arithmetic & string
-  // Template only accepts arithmatic types
-  template <class T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
-  void process(const T& data)
+  size_t chain_length() const { return patches; }
+
+private:
+  void read_base(T& data)
   {
-    // Write in data
-    T data_copy = data;
-    file.write(reinterpret_cast<char*>(&data_copy), sizeof(data));
+    BinaryDeserializer processor(prefix + ".base", options);
+    processor.process(base_id);
+    processor.process(data);
+    processor.finish();
   }
-  // String
-  void process(const std::string& data)
+  void read_chain(T& data)
   {
-    size_t len = data.length(); // Start with lenth
-    process(len);               // Write len in file
-    file.write(data.data(), len);
+    read_base(data);
+    for (patches = 0; intact(patch_name(patches + 1)); patches++) {
+      BinaryDeserializer processor(patch_name(patches + 1), patch_options);
+      uint64_t base = 0, index = 0;
+      processor.process(base);
+      processor.process(index);
+      if (base != base_id || index != patches + 1) {
+        break;
+      }
+      Patch::read(processor, data);
+      processor.finish();
+    }
+  }
+  std::string patch_name(uint64_t index) const
+  {
+    return prefix + "." + std::to_string(index);
   }
 
-  // STL containers
-  // Pair
-  template <class T1, class T2>
-  void process(const std::pair<T1, T2>& data)
+  static uint64_t new_id()
   {
-    process(data.first);
-    process(data.second);
+    std::random_device device;
+    uint64_t id = (uint64_t(device()) << 32) ^ device();
+    return id ^ uint64_t(std::chrono::steady_clock::now()
+                             .time_since_epoch()
+                             .count());
   }
-  // Vector
-  template <class T>
-  void process(const std::vector<T>& data)
+
+  // True if the file exists and every chunk of it checks out, verified
+  // before decoding so a bad patch is never half applied
+  static bool intact(const std::string& file_name)
   {
-    process(data.size()); // Write in the lenth of data
-    for (const T& value :
-         data) { // Traverse through the vector and save everything
-      process(value);
+    std::filebuf file;
+    if (!file.open(file_name, std::ios::in | std::ios::binary)) {
+      return false;
     }
+    try {
+      FrameReader(&file).finish();
+    } catch (const MyErr&) {
+      return false;
+    }
+    return true;
   }
-  // List
-  template <class T>
-  void process(const std::list<T>& data)
+
+  // Remove patch files from index on, last first so an interrupted removal
+  // never leaves a gap in front of stale patches
+  void remove_chain(uint64_t index) const
   {
-    process(data.size()); // Write in the lenth of data
-    for (const T& value :
-         data) { // Traverse through the list and save everything
-      process(value);
+    uint64_t end = index;
+    while (std::ifstream(patch_name(end)).good()) {
+      end++;
+    }
+    while (end-- > index) {
+      std::remove(patch_name(end).c_str());
     }
   }
-  // Set
-  template <class T>
-  void process(const std::set<T>& data)
+
+  std::string prefix;
+  size_t compact_every;
+  BinaryOptions options;
+  BinaryOptions patch_options; // options, always framed
+  BinaryOptions body_options;  // options without stages, for patch bodies
+  uint64_t base_id = 0;
+  size_t patches = 0;        // Patches since the base
+  bool tail_checked = false; // Files after the chain removed
+  std::optional<T> last;     // State the next patch is taken against
+};
+
+// Read-only view of a whole file
+// Backed by mmap where available, otherwise the file is read into memory
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& file_name)
   {
-    process(data.size()); // Write in the lenth of data
-    for (const T& value :
-         data) { // Traverse through the set and save everything
-      process(value);
+#ifdef MY_SERIALIZER_HAS_MMAP
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw MyErr("MappedFile: Failed to open target file");
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+      ::close(fd);
+      throw MyErr("MappedFile: Failed to stat target file");
     }
+    len = static_cast<size_t>(info.st_size);
+    if (len > 0) { // mmap refuses empty mappings
+      void* addr = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        throw MyErr("MappedFile: Failed to map target file");
+      }
+      ptr = static_cast<const char*>(addr);
+    }
+    ::close(fd); // The mapping keeps the file alive
+#else
+    std::ifstream fin(file_name, std::ios::binary);
+    if (!fin.is_open()) {
+      throw MyErr("MappedFile: Failed to open target file");
+    }
+    fallback.assign(std::istreambuf_iterator<char>(fin),
+                    std::istreambuf_iterator<char>());
+    ptr = fallback.data();
+    len = fallback.size();
+#endif
   }
-  // Map
-  template <class T1, class T2>
-  void process(const std::map<T1, T2>& data)
+  ~MappedFile()
   {
-    process(data.size()); // Write in the lenth of data
-    for (const auto& [key, value] :
-         data) { // Traverse through the map and save everything
-      process(key);
-      process(value);
+#ifdef MY_SERIALIZER_HAS_MMAP
+    if (ptr) {
+      ::munmap(const_cast<char*>(ptr), len);
     }
+#endif
   }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return ptr; }
+  size_t size() const { return len; }
 
 private:
-  std::fstream file; // Target file
+  const char* ptr = nullptr;
+  size_t len = 0;
+#ifndef MY_SERIALIZER_HAS_MMAP
+  std::vector<char> fallback;
+#endif
 };
 
-class BinaryDeserializer {
-public:
-  BinaryDeserializer(const std::string& file_name)
-  {
-    // Load mode: open target file and throw execption if failed.
-    file.open(file_name, std::ios::binary | std::ios::in);
-    if (!file.is_open()) {
-      throw MyErr("BinarySerializer: Failed to open target file");
-    }
+// On-disk sorted map (SSTable-like)
+// Layout: [blocks of key/value pairs][index][footer]
+// Every block holds up to block_entries pairs in ascending key order, the
+// index stores the first key and offset of every block, and the footer
+// (fixed size, at the end of file) locates the index
+// Keys and values use the same encoding as BinarySerializer
+constexpr uint64_t mapped_map_magic = 0x3130504d4153594dULL; // "MYSAMP01"
+
+template <class K, class V>
+void serialize_mapped(const std::map<K, V>& data, const std::string& file_name,
+                      size_t block_entries = 64)
+{
+  if (block_entries == 0) {
+    throw MyErr("serialize_mapped: Block size must be positive");
   }
-  ~BinaryDeserializer()
-  {
-    if (file.is_open())
-      file.close();
+  FileIO::drop_fingerprint(file_name);
+  std::filebuf file;
+  if (!file.open(file_name,
+                 std::ios::binary | std::ios::out | std::ios::trunc)) {
+    throw MyErr("serialize_mapped: Failed to open target file");
   }
+  BinarySerializer processor(&file);
+  // Flushes what is buffered, so a failed write shows up as -1 here
+  bool failed = false;
+  auto tell = [&file, &failed]() {
+    std::streamoff pos = file.pubseekoff(0, std::ios::cur, std::ios::out);
+    failed = failed || pos < 0;
+    return static_cast<size_t>(pos);
+  };
 
-  // Basic types: arithmetic & string
-  // Template only accepts arithmatic types
-  template <class T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
-  void process(T& data)
-  {
-    // Read data from file
-    file.read(reinterpret_cast<char*>(&data), sizeof(data));
+  // Data blocks, remember where every block starts
+  std::vector<size_t> block_offsets;
+  size_t cnt = 0;
+  for (const auto& [key, value] : data) {
+    if (cnt++ % block_entries == 0) {
+      block_offsets.push_back(tell());
+    }
+    processor.process(key);
+    processor.process(value);
   }
-  // String
-  void process(std::string& data)
-  {
-    size_t len;
-    process(len); // Read in len
-    data.resize(len);
-    file.read(data.data(), len);
+
+  // Sparse index: first key of every block
+  size_t index_offset = tell();
+  auto it = data.begin();
+  for (size_t i = 0; i < block_offsets.size(); i++) {
+    processor.process(block_offsets[i]);
+    processor.process(it->first);
+    std::advance(it, std::min(block_entries, data.size() - i * block_entries));
   }
 
-  // STL containers
-  // Pair
-  template <class T1, class T2>
-  void process(std::pair<T1, T2>& data)
-  {
-    process(data.first);
-    process(data.second);
+  // Footer
+  processor.process(index_offset);
+  processor.process(block_offsets.size());
+  processor.process(data.size());
+  processor.process(mapped_map_magic);
+
+  // A short write (disk full...) must not leave a truncated map behind
+  processor.close();
+  size_t end = tell();
+  bool closed = file.close() != nullptr;
+  std::ifstream written(file_name, std::ios::binary | std::ios::ate);
+  if (failed || !closed || !written ||
+      static_cast<size_t>(written.tellg()) != end) {
+    throw MyErr("serialize_mapped: Cannot write " + file_name);
   }
-  // Vector
-  template <class T>
-  void process(std::vector<T>& data)
+}
+
+// Read-only view of a file written by serialize_mapped()
+// Only the sparse index is loaded, lookups binary search the index and then
+// scan a single block directly from the mapped file
+// All const members are safe to call from several threads
+template <class K, class V>
+class MappedMap {
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+
+  // Forward iterator decoding one entry at a time from the mapping
+  // Arithmetic keys and values and strings are read straight from the
+  // mapping; other types go through a decoding cursor shared by the copies
+  // of an iterator, so those must stay on the same thread, but advancing one
+  // never moves the others
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<K, V>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    const_iterator() = default;
+
+    reference operator*() const { return entry; }
+    pointer operator->() const { return &entry; }
+    const_iterator& operator++()
+    {
+      load(next);
+      return *this;
+    }
+    const_iterator operator++(int)
+    {
+      const_iterator old = *this;
+      ++*this;
+      return old;
+    }
+    bool operator==(const const_iterator& other) const
+    {
+      return pos == other.pos;
+    }
+    bool operator!=(const const_iterator& other) const
+    {
+      return pos != other.pos;
+    }
+
+  private:
+    friend class MappedMap;
+
+    // Types read from the mapping without a cursor, plain encoding
+    template <class T>
+    static constexpr bool direct =
+        std::is_arithmetic_v<T> || std::is_same_v<T, std::string>;
+    static constexpr bool needs_cursor = !direct<K> || !direct<V>;
+
+    // Decoder state over the data blocks of the mapping
+    struct Cursor {
+      MemoryBuffer buf;
+      BinaryDeserializer reader;
+      Cursor(const char* data, size_t size) : buf(data, size), reader(&buf)
+      {
+      }
+    };
+
+    // end(), nothing to decode
+    explicit const_iterator(size_t data_end)
+        : data_end(data_end), pos(data_end), next(data_end)
+    {
+    }
+    const_iterator(const char* data, size_t data_end, size_t offset)
+        : data(data), data_end(data_end)
+    {
+      if constexpr (needs_cursor) {
+        cursor = std::make_shared<Cursor>(data, data_end);
+      }
+      load(offset);
+    }
+
+    // Decode the entry starting at offset (or become end())
+    void load(size_t offset)
+    {
+      pos = offset;
+      if (pos >= data_end) {
+        pos = next = data_end;
+        return;
+      }
+      if constexpr (needs_cursor) {
+        cursor->buf.pubseekpos(pos, std::ios::in);
+        cursor->reader.process(entry.first);
+        cursor->reader.process(entry.second);
+        next = cursor->buf.offset();
+      } else {
+        next = pos;
+        read(entry.first);
+        read(entry.second);
+      }
+    }
+    template <class T>
+    void read(T& out)
+    {
+      if constexpr (std::is_arithmetic_v<T>) {
+        take(reinterpret_cast<char*>(&out), sizeof(out));
+      } else {
+        size_t len;
+        read(len);
+        if (len > data_end - next) {
+          throw MyErr("MappedMap: Corrupted entry");
+        }
+        out.assign(data + next, len);
+        next += len;
+      }
+    }
+    void take(char* dst, size_t len)
+    {
+      if (len > data_end - next) {
+        throw MyErr("MappedMap: Corrupted entry");
+      }
+      std::memcpy(dst, data + next, len);
+      next += len;
+    }
+
+    const char* data = nullptr;
+    std::shared_ptr<Cursor> cursor; // Only for types read with a cursor
+    size_t data_end = 0;
+    size_t pos = 0;  // Offset of the current entry
+    size_t next = 0; // Offset of the entry after it
+    value_type entry;
+  };
+  using iterator = const_iterator;
+
+  explicit MappedMap(const std::string& file_name) : mapping(file_name)
   {
-    size_t len; // Read in the lenth
-    process(len);
-    data.clear();
-    data.resize(len);       // Clear and resize the vector
-    for (T& value : data) { // Traverse through the vector and load everything
-      process(value);
+    const size_t footer_size = 3 * sizeof(size_t) + sizeof(uint64_t);
+    if (mapping.size() < footer_size) {
+      throw MyErr("MappedMap: File too small");
+    }
+    MemoryBuffer buf(mapping.data(), mapping.size());
+    BinaryDeserializer reader(&buf);
+
+    // Footer
+    buf.pubseekpos(mapping.size() - footer_size, std::ios::in);
+    size_t block_cnt;
+    uint64_t magic;
+    reader.process(data_end);
+    reader.process(block_cnt);
+    reader.process(entry_cnt);
+    reader.process(magic);
+    if (magic != mapped_map_magic || data_end > mapping.size() - footer_size) {
+      throw MyErr("MappedMap: Not a mapped map file");
+    }
+
+    // Sparse index
+    buf.pubseekpos(data_end, std::ios::in);
+    block_offsets.resize(block_cnt);
+    first_keys.resize(block_cnt);
+    for (size_t i = 0; i < block_cnt; i++) {
+      reader.process(block_offsets[i]);
+      reader.process(first_keys[i]);
+      if (block_offsets[i] >= data_end) {
+        throw MyErr("MappedMap: Corrupted index");
+      }
     }
   }
-  // List
-  template <class T>
-  void process(std::list<T>& data)
+
+  size_t size() const { return entry_cnt; }
+  bool empty() const { return entry_cnt == 0; }
+
+  const_iterator begin() const { return at(0); }
+  const_iterator end() const { return const_iterator(data_end); }
+
+  // First entry whose key is not less than key
+  const_iterator lower_bound(const K& key) const
   {
-    size_t len; // Read in the lenth
-    process(len);
-    data.clear();
-    data.resize(len);       // Clear and resize the list
-    for (T& value : data) { // Traverse through the list and load everything
-      process(value);
+    // Last block whose first key <= key, the answer is in it or is the first
+    // entry of the following block
+    size_t block =
+        std::upper_bound(first_keys.begin(), first_keys.end(), key) -
+        first_keys.begin();
+    if (block == 0) {
+      return begin();
+    }
+    const_iterator it = at(block_offsets[block - 1]);
+    while (it.pos != data_end && it.entry.first < key) {
+      ++it;
     }
+    return it;
   }
-  // Set
-  template <class T>
-  void process(std::set<T>& data)
+  // First entry whose key is greater than key
+  const_iterator upper_bound(const K& key) const
   {
-    size_t len; // Read in the lenth
-    process(len);
-    data.clear();                      // Clear the set
-    for (size_t i = 0; i < len; i++) { // Load data one by one
-      T value;
-      process(value);
-      data.insert(value);
+    const_iterator it = lower_bound(key);
+    while (it.pos != data_end && !(key < it.entry.first)) {
+      ++it;
     }
+    return it;
   }
-  // Map
-  template <class T1, class T2>
-  void process(std::map<T1, T2>& data)
+  const_iterator find(const K& key) const
   {
-    size_t len; // Read in the lenth
-    process(len);
-    data.clear();                      // Clear the map
-    for (size_t i = 0; i < len; i++) { // Load data one by one
-      T1 key;
-      T2 value;
-      process(key);
-      process(value);
-      data[key] = value; // Insert [key, value] into map
+    const_iterator it = lower_bound(key);
+    if (it.pos != data_end && !(key < it.entry.first)) {
+      return it;
     }
+    return end();
+  }
+  bool contains(const K& key) const
+  {
+    const_iterator it = lower_bound(key);
+    return it.pos != data_end && !(key < it.entry.first);
   }
 
 private:
-  std::fstream file; // Target file
-};
-
-// Top functions for serialization & deserialization
-template <class T>
-void serialize(const T& data, const std::string& file_name)
-{
-  BinarySerializer processor(file_name);
-  processor.process(data);
-}
+  const_iterator at(size_t offset) const
+  {
+    return const_iterator(mapping.data(), data_end, offset);
+  }
 
-template <class T>
-void deserialize(T& data, const std::string& file_name)
-{
-  BinaryDeserializer processor(file_name);
-  processor.process(data);
-}
+  MappedFile mapping;
+  std::vector<size_t> block_offsets; // Start of every block
+  std::vector<K> first_keys;         // First key of every block
+  size_t data_end = 0;               // Data blocks end where the index starts
+  size_t entry_cnt = 0;
+};
 
 } // namespace BinarySerialize
 
@@ -413,19 +6208,40 @@ public:
     // Create root node "<serialization></serialization>"
     root_ele = file.NewElement("serialization");
     file.InsertFirstChild(root_ele);
+    pos = root_ele;
   }
   ~XMLSerializer()
   {
-    // Save to file when destructing
+    // Save to file when destructing, unless already saved
+    if (!saved) {
+      try {
+        save();
+      } catch (MyErr&) {
+        // Destructors cannot report errors, call save() to get them
+      }
+    }
+  }
+
+  // Write the document to the file, throws if that fails
+  void save()
+  {
+    saved = true;
+    FileIO::drop_fingerprint(file_name);
+    bool ok;
     if (mode == XMLMode::text) {
-      file.SaveFile(file_name.c_str()); // Use build-in method
-    } else {                            // Binary version
+      // Use build-in method
+      ok = file.SaveFile(file_name.c_str()) == XML_SUCCESS;
+    } else { // Binary version
       XMLConverter convert;
       std::string encoded = convert(file);
       // Open terget file in binary mode
       std::ofstream fout(file_name, std::ios::binary | std::ios::trunc);
       fout.write(encoded.data(), encoded.size());
       fout.close();
+      ok = !fout.fail();
+    }
+    if (!ok) {
+      throw MyErr("XMLSerializer: Cannot write " + file_name);
     }
   }
 
@@ -434,142 +6250,84 @@ public:
   void process(const T& data)
   {
     // Create new <field> node
-    cur_ele = file.NewElement("field");
-    root_ele->InsertEndChild(cur_ele);
-    process(data, cur_ele);
+    begin_item("field");
+    value(data);
+    end_item();
   }
 
-protected:
+  // Archive hooks, see Traversal
+  // Every node goes under the current one (pos), containers look like
+  // <vector><length val="2"/><item .../><item .../></vector>
+  static constexpr bool loading = false;
+
   // Basic types
   // In the form of single element such as <posName val="3"/>
-
-  // pos: current level of document (parent)
   template <class T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
-  void process(const T& data, XMLElement* pos)
+  void leaf(const T& data)
   {
     pos->SetAttribute("val", data); // Set attribute
     // There is only one data under pos because it is a basic type
     // So no collisions will happen
   }
   // String
-  void process(const std::string& data, XMLElement* pos)
+  void leaf(const std::string& data)
   {
     pos->SetAttribute("val", data.c_str()); // Same as before
   }
-
-  // STL containers
-  // Pair
-  template <class T1, class T2>
-  void process(const std::pair<T1, T2>& data, XMLElement* pos)
-  {
-    // Create <pair> node
-    XMLElement* pair_ele = file.NewElement("pair");
-    pos->InsertEndChild(pair_ele);
-
-    // Create <first> & <second> node under <pair>
-    XMLElement* first_ele = file.NewElement("first");
-    pair_ele->InsertEndChild(first_ele);
-    process(data.first, first_ele); // Process inner data recursively
-
-    XMLElement* second_ele = file.NewElement("second");
-    pair_ele->InsertEndChild(second_ele);
-    process(data.second, second_ele);
-  }
-  // Vector
-  template <class T>
-  void process(const std::vector<T>& data, XMLElement* pos)
+  void leaf(std::string_view data) { leaf(std::string(data)); }
+  size_t begin_sequence(const char* tag, size_t len)
   {
-    // Create <vector> node
-    XMLElement* vec_ele = file.NewElement("vector");
-    pos->InsertEndChild(vec_ele);
-
-    // Write the length of vector
+    begin_node(tag);
+    // Write the length of container
     XMLElement* len_ele = file.NewElement("length");
-    vec_ele->InsertEndChild(len_ele);
-    process(data.size(), len_ele);
-
-    for (const T& value : data) { // Process everything in data one by one
-      XMLElement* item_ele = file.NewElement("item");
-      vec_ele->InsertEndChild(item_ele);
-      process(value, item_ele);
-    }
+    pos->InsertEndChild(len_ele);
+    len_ele->SetAttribute("val", len);
+    return len;
   }
-  // List
-  template <class T>
-  void process(const std::list<T>& data, XMLElement* pos)
-  {
-    // Create <list> node
-    XMLElement* list_ele = file.NewElement("list");
-    pos->InsertEndChild(list_ele);
-
-    // Write the length of list
-    XMLElement* len_ele = file.NewElement("length");
-    list_ele->InsertEndChild(len_ele);
-    process(data.size(), len_ele);
+  void end_sequence() { end_node(); }
+  void begin_object(const char* tag) { begin_node(tag); }
+  void end_object() { end_node(); }
+  void begin_item(const char* name) { begin_node(name); }
+  void end_item() { end_node(); }
+  Traversal::SharedObjects& shared_objects() { return shared; }
 
-    for (const T& value : data) { // Process everything in data one by one
-      XMLElement* item_ele = file.NewElement("item");
-      list_ele->InsertEndChild(item_ele);
-      process(value, item_ele);
-    }
-  }
-  // Set
   template <class T>
-  void process(const std::set<T>& data, XMLElement* pos)
+  void value(const T& data)
   {
-    // Create <set> node
-    XMLElement* set_ele = file.NewElement("set");
-    pos->InsertEndChild(set_ele);
-
-    // Write the length of set
-    XMLElement* len_ele = file.NewElement("length");
-    set_ele->InsertEndChild(len_ele);
-    process(data.size(), len_ele);
+    Traversal::traverse(*this, data);
+  }
 
-    for (const T& value : data) { // Process everything in data one by one
-      XMLElement* item_ele = file.NewElement("item");
-      set_ele->InsertEndChild(item_ele);
-      process(value, item_ele);
-    }
+protected:
+  void begin_node(const char* tag)
+  {
+    XMLElement* ele = file.NewElement(tag);
+    pos->InsertEndChild(ele);
+    parents.push_back(pos);
+    pos = ele;
   }
-  // Map
-  template <class T1, class T2>
-  void process(const std::map<T1, T2>& data, XMLElement* pos)
+  void end_node()
   {
-    // Create <map> node
-    XMLElement* map_ele = file.NewElement("map");
-    pos->InsertEndChild(map_ele);
-
-    // Write the length of set
-    XMLElement* len_ele = file.NewElement("length");
-    map_ele->InsertEndChild(len_ele);
-    process(data.size(), len_ele);
-
-    for (const auto& [key, value] : data) {
-      XMLElement* item_ele = file.NewElement("item");
-      map_ele->InsertEndChild(item_ele);
-      // <key> and <value> node for map item
-      XMLElement* key_ele = file.NewElement("key");
-      item_ele->InsertEndChild(key_ele);
-      process(key, key_ele);
-      XMLElement* val_ele = file.NewElement("value");
-      item_ele->InsertEndChild(val_ele);
-      process(value, val_ele);
-    }
+    pos = parents.back();
+    parents.pop_back();
   }
 
   XMLDocument file;     // Target file
   XMLElement* root_ele; // Constantly point to root node <serialization>
-  XMLElement* cur_ele;  // Current starting position of serialization, used for
-                        // user-defined type
-  const std::string file_name; // Used when saved to file
+  XMLElement* pos;      // Current node, where new nodes go
+  std::vector<XMLElement*> parents; // Nodes to go back to
+  const std::string file_name;      // Used when saved to file
   XMLMode mode;
+  bool saved = false;
+  Traversal::SharedObjects shared; // Objects behind shared pointers
 };
 
 class XMLDeserializer {
 public:
-  XMLDeserializer(const std::string& file_name, XMLMode mode = XMLMode::text)
-      : mode(mode)
+  // strings: arena for loaded std::string_view, like BinaryOptions::strings
+  XMLDeserializer(
+      const std::string& file_name, XMLMode mode = XMLMode::text,
+      std::shared_ptr<BinarySerialize::StringArena> strings = nullptr)
+      : mode(mode), strings(std::move(strings))
   {
     // Try load from file
     if (mode == XMLMode::text) {
@@ -600,11 +6358,11 @@ public:
     if (!root_ele) { // Failed to found
       throw MyErr("Failed to found root element <serialization>.");
     }
-    // Get first field node
-    cur_ele = root_ele->FirstChildElement("field");
-    if (!cur_ele) {
+    // Check first field node
+    if (!root_ele->FirstChildElement("field")) {
       throw MyErr("Element <field> not found in <serialization>.");
     }
+    nodes.push_back({root_ele, nullptr});
   }
   virtual ~XMLDeserializer() {}
 
@@ -612,131 +6370,112 @@ public:
   template <class T>
   void process(T& data)
   {
-    if (!cur_ele) {
-      throw MyErr("Field not found.");
-    }
-
-    process(data, cur_ele);
-    cur_ele = cur_ele->NextSiblingElement("field");
+    begin_item("field"); // Next <field> node
+    value(data);
+    end_item();
   }
 
-protected:
+  // Archive hooks, see Traversal and XMLSerializer
+  static constexpr bool loading = true;
+
   // Basic types
-  // pos: target location (parent node)
   template <class T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
-  void process(T& data, XMLElement* pos)
+  void leaf(T& data)
   {
-    const char* val = pos->Attribute("val");
-    std::istringstream iss(val);
+    if constexpr (std::is_same_v<T, bool>) { // Written as "true"/"false"
+      if (pos()->QueryBoolAttribute("val", &data) != XML_SUCCESS) {
+        throw MyErr("Attribute val not found.");
+      }
+      return;
+    }
+    std::istringstream iss(attribute());
     double tmp; // Avoid char type being truncated
     iss >> tmp;
     data = static_cast<T>(tmp);
   }
-  // String
-  void process(std::string& data, XMLElement* pos)
+  // String, with any allocator
+  template <class Alloc>
+  void leaf(std::basic_string<char, std::char_traits<char>, Alloc>& data)
   {
-    data.assign(pos->Attribute("val"));
+    data.assign(attribute());
   }
-
-  // STL containers
-  // Pair
-  template <class T1, class T2>
-  void process(std::pair<T1, T2>& data, XMLElement* pos)
+  // String view, points into the arena
+  void leaf(std::string_view& data)
   {
-    XMLElement* pair_ele = pos->FirstChildElement("pair");
-    // Respectively process first and second
-    XMLElement* first_ele = pair_ele->FirstChildElement("first");
-    process(data.first, first_ele);
-    XMLElement* second_ele = pair_ele->FirstChildElement("second");
-    process(data.second, second_ele);
+    if (!strings) {
+      throw MyErr("XMLDeserializer: Loading std::string_view requires a "
+                  "StringArena");
+    }
+    data = strings->intern(attribute());
   }
-  // Vector
-  template <class T>
-  void process(std::vector<T>& data, XMLElement* pos)
+  size_t begin_sequence(const char* tag, size_t)
   {
-    XMLElement* vec_ele = pos->FirstChildElement("vector");
-    size_t len;
-    XMLElement* len_ele = vec_ele->FirstChildElement("length");
-    process(len, len_ele); // Read in length
-    // Re-initialize data
-    data.clear();
-    // Traversal through all items and load them
-    XMLElement* item_ele = vec_ele->FirstChildElement("item");
-    while (item_ele != nullptr) {
-      T value;
-      process(value, item_ele);
-      data.push_back(value);
-      item_ele = item_ele->NextSiblingElement("item");
+    begin_object(tag);
+    uint64_t len = 0; // Read in length
+    XMLElement* len_ele = pos()->FirstChildElement("length");
+    if (!len_ele ||
+        len_ele->QueryUnsigned64Attribute("val", &len) != XML_SUCCESS) {
+      throw MyErr("Element <length> not found.");
     }
+    return static_cast<size_t>(len);
   }
-  // List
-  template <class T>
-  void process(std::list<T>& data, XMLElement* pos)
+  void end_sequence() { nodes.pop_back(); }
+  void begin_object(const char* tag)
   {
-    XMLElement* list_ele = pos->FirstChildElement("list");
-    size_t len;
-    XMLElement* len_ele = list_ele->FirstChildElement("length");
-    process(len, len_ele); // Read in length
-    // Re-initialize data
-    data.clear();
-    // Traversal through all items and load them
-    XMLElement* item_ele = list_ele->FirstChildElement("item");
-    while (item_ele != nullptr) {
-      T value;
-      process(value, item_ele);
-      data.push_back(value);
-      item_ele = item_ele->NextSiblingElement("item");
-    }
+    nodes.push_back({child(pos()->FirstChildElement(tag), tag), nullptr});
   }
-  // Set
+  void end_object() { nodes.pop_back(); }
+  // Items with the same name are visited in document order
+  void begin_item(const char* name)
+  {
+    Node& parent = nodes.back();
+    XMLElement* ele = parent.last ? parent.last->NextSiblingElement(name)
+                                  : parent.ele->FirstChildElement(name);
+    parent.last = child(ele, name);
+    nodes.push_back({ele, nullptr});
+  }
+  void end_item() { nodes.pop_back(); }
+  Traversal::SharedObjects& shared_objects() { return shared; }
+
   template <class T>
-  void process(std::set<T>& data, XMLElement* pos)
+  void value(T& data)
   {
-    XMLElement* set_ele = pos->FirstChildElement("set");
-    size_t len;
-    XMLElement* len_ele = set_ele->FirstChildElement("length");
-    process(len, len_ele); // Read in length
-    // Re-initialize data
-    data.clear();
-    // Traversal through all items and load them
-    XMLElement* item_ele = set_ele->FirstChildElement("item");
-    while (item_ele != nullptr) {
-      T value;
-      process(value, item_ele);
-      data.insert(value); // Insert into set
-      item_ele = item_ele->NextSiblingElement("item");
+    Traversal::traverse(*this, data);
+  }
+
+protected:
+  struct Node {
+    XMLElement* ele;
+    XMLElement* last; // Last child item visited
+  };
+
+  XMLElement* pos() const { return nodes.back().ele; }
+  const char* attribute() const
+  {
+    const char* val = pos()->Attribute("val");
+    if (!val) {
+      throw MyErr("Attribute val not found.");
     }
+    return val;
   }
-  // Map
-  template <class T1, class T2>
-  void process(std::map<T1, T2>& data, XMLElement* pos)
+  static XMLElement* child(XMLElement* ele, const char* name)
   {
-    XMLElement* map_ele = pos->FirstChildElement("map");
-    size_t len;
-    XMLElement* len_ele = map_ele->FirstChildElement("length");
-    process(len, len_ele); // Read in length
-    // Re-initialize data
-    data.clear();
-    // Traversal through all items and load them
-    XMLElement* item_ele = map_ele->FirstChildElement("item");
-    while (item_ele != nullptr) {
-      T1 key;
-      T2 value;
-      process(key, item_ele->FirstChildElement("key"));
-      process(value, item_ele->FirstChildElement("value"));
-      data[key] = value; // Insert [key, value] into map
-      item_ele = item_ele->NextSiblingElement("item");
+    if (!ele) {
+      throw MyErr(std::string("Element <") + name + "> not found.");
     }
+    return ele;
   }
 
   XMLDocument file; // Target file
   XMLElement* root_ele;
-  XMLElement* cur_ele; // Currently loading <field> node
+  std::vector<Node> nodes; // Path from <serialization> to the current node
   XMLMode mode;
+  Traversal::SharedObjects shared; // Objects behind shared pointers
+  std::shared_ptr<BinarySerialize::StringArena> strings;
 };
 
 // Wrapper class for binary version of xml serialization
-// Used for user-defined type macro expansion
+// Used by the top functions below
 class XMLSerializerBase64 : public XMLSerializer {
 public:
   // Call binary mode of base Ctor
@@ -749,129 +6488,171 @@ public:
 
 class XMLDeserializerBase64 : public XMLDeserializer {
 public:
-  XMLDeserializerBase64(const std::string& file_name)
-      : XMLDeserializer(file_name, XMLMode::binary)
+  XMLDeserializerBase64(
+      const std::string& file_name,
+      std::shared_ptr<BinarySerialize::StringArena> strings = nullptr)
+      : XMLDeserializer(file_name, XMLMode::binary, std::move(strings))
   {
   }
 };
 
+// Top-level data: each field of a user-defined type is a <field> node of its
+// own, anything else is a single <field> node
+template <class Processor, class T>
+void process_top(Processor& processor, T& data)
+{
+  if constexpr (Traversal::user_type<T>) {
+    UserFields<std::remove_cv_t<T>>::apply(processor, data);
+  } else {
+    processor.process(data);
+  }
+}
+
 // Top functions for serialization & deserialization
 template <class T>
 void serialize_xml(const T& data, const std::string& file_name)
 {
   XMLSerializer processor(file_name);
-  processor.process(data);
+  process_top(processor, data);
+  processor.save();
 }
 
+// std::string_view fields need an arena to point into
 template <class T>
-void deserialize_xml(T& data, const std::string& file_name)
+void deserialize_xml(
+    T& data, const std::string& file_name,
+    std::shared_ptr<BinarySerialize::StringArena> strings = nullptr)
 {
-  XMLDeserializer processor(file_name);
-  processor.process(data);
+  XMLDeserializer processor(file_name, XMLMode::text, std::move(strings));
+  process_top(processor, data);
 }
 
 template <class T>
 void serialize_xml_base64(const T& data, const std::string& file_name)
 {
   XMLSerializerBase64 processor(file_name);
-  processor.process(data);
+  process_top(processor, data);
+  processor.save();
 }
 
 template <class T>
-void deserialize_xml_base64(T& data, const std::string& file_name)
+void deserialize_xml_base64(
+    T& data, const std::string& file_name,
+    std::shared_ptr<BinarySerialize::StringArena> strings = nullptr)
 {
-  XMLDeserializerBase64 processor(file_name);
-  processor.process(data);
+  XMLDeserializerBase64 processor(file_name, std::move(strings));
+  process_top(processor, data);
 }
 
 } // namespace XMLSerialize
 
+namespace Traversal {
+// Every archive a polymorphic type can be processed with
+template <class Base>
+template <class Derived>
+bool Polymorphic<Base>::add(uint32_t id)
+{
+  Registry& types = registry();
+  if (id == unregistered) {
+    throw MyErr("Traversal: Invalid polymorphic type id");
+  }
+  if (derived_id<Derived> == id) {
+    return true; // Same registration from another translation unit
+  }
+  if (derived_id<Derived> != unregistered) {
+    throw MyErr("Traversal: Polymorphic type registered with another id");
+  }
+  if (id < types.create.size() && types.create[id]) {
+    throw MyErr("Traversal: Polymorphic type id registered twice");
+  }
+  derived_id<Derived> = id;
+  types.ids[&typeid(Derived)] = id;
+  if (types.create.size() <= id) {
+    types.create.resize(id + 1);
+  }
+  types.create[id] = []() -> Base* { return new Derived(); };
+  add_to<Derived, BinarySerialize::BinarySerializer>(id);
+  add_to<Derived, BinarySerialize::BinaryDeserializer>(id);
+  add_to<Derived, BinarySerialize::SizeCounter>(id);
+  add_to<Derived, XMLSerialize::XMLSerializer>(id);
+  add_to<Derived, XMLSerialize::XMLDeserializer>(id);
+  return true;
+}
+} // namespace Traversal
+
 // Macro for user-defined types
-// Implemented by generating specialized functions for user-defined types
-#define MY_SERIALIZE(Type, argcnt, ...)                                        \
-  namespace BinarySerialize {                                                  \
-  void serialize(const Type& data, const std::string& file_name)               \
-  {                                                                            \
-    BinarySerializer processor(file_name);                                     \
-    SERIALIZE_##argcnt(__VA_ARGS__)                                            \
-  }                                                                            \
-  void deserialize(Type& data, const std::string& file_name)                   \
-  {                                                                            \
-    BinaryDeserializer processor(file_name);                                   \
-    SERIALIZE_##argcnt(__VA_ARGS__)                                            \
-  }                                                                            \
-  }                                                                            \
-  namespace XMLSerialize {                                                     \
-  void serialize_xml(const Type& data, const std::string& file_name)           \
-  {                                                                            \
-    XMLSerializer processor(file_name);                                        \
-    SERIALIZE_##argcnt(__VA_ARGS__)                                            \
-  }                                                                            \
-  void deserialize_xml(Type& data, const std::string& file_name)               \
-  {                                                                            \
-    XMLDeserializer processor(file_name);                                      \
-    SERIALIZE_##argcnt(__VA_ARGS__)                                            \
-  }                                                                            \
-  void serialize_xml_base64(const Type& data, const std::string& file_name)    \
-  {                                                                            \
-    XMLSerializerBase64 processor(file_name);                                  \
-    SERIALIZE_##argcnt(__VA_ARGS__)                                            \
-  }                                                                            \
-  void deserialize_xml_base64(Type& data, const std::string& file_name)        \
-  {                                                                            \
-    XMLDeserializerBase64 processor(file_name);                                \
-    SERIALIZE_##argcnt(__VA_ARGS__)                                            \
-  }                                                                            \
-  }
-
-// Expansion list for types with more than one field
-// SERIALIZE_N() processes the first data and calls SERIALIZE_N-1() recursively
-// and ends at SERIALIZE_1()
-#define SERIALIZE_1(var) processor.process(data.var);
-#define SERIALIZE_2(var, ...)                                                  \
-  processor.process(data.var);                                                 \
-  SERIALIZE_1(__VA_ARGS__)
-#define SERIALIZE_3(var, ...)                                                  \
-  processor.process(data.var);                                                 \
-  SERIALIZE_2(__VA_ARGS__)
-#define SERIALIZE_4(var, ...)                                                  \
-  processor.process(data.var);                                                 \
-  SERIALIZE_3(__VA_ARGS__)
-#define SERIALIZE_5(var, ...)                                                  \
-  processor.process(data.var);                                                 \
-  SERIALIZE_4(__VA_ARGS__)
-#define SERIALIZE_6(var, ...)                                                  \
-  processor.process(data.var);                                                 \
-  SERIALIZE_5(__VA_ARGS__)
-#define SERIALIZE_7(var, ...)                                                  \
-  processor.process(data.var);                                                 \
-  SERIALIZE_6(__VA_ARGS__)
-#define SERIALIZE_8(var, ...)                                                  \
-  processor.process(data.var);                                                 \
-  SERIALIZE_7(__VA_ARGS__)
-#define SERIALIZE_9(var, ...)                                                  \
-  processor.process(data.var);                                                 \
-  SERIALIZE_8(__VA_ARGS__)
-#define SERIALIZE_10(var, ...)                                                 \
-  processor.process(data.var);                                                 \
-  SERIALIZE_9(__VA_ARGS__)
-#define SERIALIZE_11(var, ...)                                                 \
-  processor.process(data.var);                                                 \
-  SERIALIZE_10(__VA_ARGS__)
-#define SERIALIZE_12(var, ...)                                                 \
-  processor.process(data.var);                                                 \
-  SERIALIZE_11(__VA_ARGS__)
-#define SERIALIZE_13(var, ...)                                                 \
-  processor.process(data.var);                                                 \
-  SERIALIZE_12(__VA_ARGS__)
-#define SERIALIZE_14(var, ...)                                                 \
-  processor.process(data.var);                                                 \
-  SERIALIZE_13(__VA_ARGS__)
-#define SERIALIZE_15(var, ...)                                                 \
-  processor.process(data.var);                                                 \
-  SERIALIZE_14(__VA_ARGS__)
-#define SERIALIZE_16(var, ...)                                                 \
-  processor.process(data.var);                                                 \
-  SERIALIZE_15(__VA_ARGS__)
-
-// Can add more if necessary
\ No newline at end of file
+// MY_SERIALIZE_FIELDS(Type, field1, field2 ...) lists the fields to
+// serialize, for types that are not plain aggregates (or to pick fields)
+// Only specializes UserFields, so it can live in a header; the list has no
+// count and takes up to 256 fields (plain aggregates without it, up to
+// Reflection::max_fields)
+#define MY_SERIALIZE_FIELDS(Type, ...)                                         \
+  template <>                                                                  \
+  struct UserFields<Type> : std::true_type {                                   \
+    static constexpr auto members()                                            \
+    {                                                                          \
+      return std::make_tuple(                                                  \
+          MY_SERIALIZE_FOR_EACH(MY_SERIALIZE_MEMBER, Type, __VA_ARGS__));      \
+    }                                                                          \
+    template <class Data>                                                      \
+    static constexpr auto fields(Data& data)                                   \
+    {                                                                          \
+      return std::apply(                                                       \
+          [&](auto... member) { return std::tie(data.*member...); },           \
+          members());                                                          \
+    }                                                                          \
+    template <class Processor, class Data>                                     \
+    static constexpr void apply(Processor& processor, Data& data)              \
+    {                                                                          \
+      std::apply(                                                              \
+          [&](auto... member) { (processor.process(data.*member), ...); },     \
+          members());                                                          \
+    }                                                                          \
+  };
+
+// Former form with a field count, which is no longer needed
+#define MY_SERIALIZE(Type, argcnt, ...) MY_SERIALIZE_FIELDS(Type, __VA_ARGS__)
+
+// MY_SERIALIZE_FOR_EACH(macro, Type, a, b ...) expands to
+// macro(Type, a), macro(Type, b) ...
+// Every rescan of MY_SERIALIZE_EXPAND handles one more field
+#define MY_SERIALIZE_MEMBER(Type, var) &Type::var
+#define MY_SERIALIZE_PARENS ()
+#define MY_SERIALIZE_EXPAND(...)                                               \
+  MY_SERIALIZE_EXPAND3(MY_SERIALIZE_EXPAND3(                                   \
+      MY_SERIALIZE_EXPAND3(MY_SERIALIZE_EXPAND3(__VA_ARGS__))))
+#define MY_SERIALIZE_EXPAND3(...)                                              \
+  MY_SERIALIZE_EXPAND2(MY_SERIALIZE_EXPAND2(                                   \
+      MY_SERIALIZE_EXPAND2(MY_SERIALIZE_EXPAND2(__VA_ARGS__))))
+#define MY_SERIALIZE_EXPAND2(...)                                              \
+  MY_SERIALIZE_EXPAND1(MY_SERIALIZE_EXPAND1(                                   \
+      MY_SERIALIZE_EXPAND1(MY_SERIALIZE_EXPAND1(__VA_ARGS__))))
+#define MY_SERIALIZE_EXPAND1(...)                                              \
+  MY_SERIALIZE_EXPAND0(MY_SERIALIZE_EXPAND0(                                   \
+      MY_SERIALIZE_EXPAND0(MY_SERIALIZE_EXPAND0(__VA_ARGS__))))
+#define MY_SERIALIZE_EXPAND0(...) __VA_ARGS__
+#define MY_SERIALIZE_FOR_EACH(macro, Type, ...)                                \
+  __VA_OPT__(                                                                  \
+      MY_SERIALIZE_EXPAND(MY_SERIALIZE_FOR_EACH_(macro, Type, __VA_ARGS__)))
+#define MY_SERIALIZE_FOR_EACH_(macro, Type, var, ...)                          \
+  macro(Type, var) __VA_OPT__(                                                 \
+      , MY_SERIALIZE_FOR_EACH_AGAIN MY_SERIALIZE_PARENS(macro, Type,           \
+                                                        __VA_ARGS__))
+#define MY_SERIALIZE_FOR_EACH_AGAIN() MY_SERIALIZE_FOR_EACH_
+
+// Macro for types stored behind pointers to a polymorphic base class
+// MY_SERIALIZE_DERIVED(Base, Derived, id), Derived needs MY_SERIALIZE too
+// id has to be unique per Base and stay the same as long as files are read,
+// small ids keep the dispatch tables small
+// Can live in a header, every translation unit registers the same pair
+// The registration variable is named after __COUNTER__ and the line, so
+// headers using the macro on the same line do not collide
+#define MY_SERIALIZE_DERIVED(Base, Derived, id)                                \
+  MY_SERIALIZE_REGISTER(Base, Derived, id, __COUNTER__, __LINE__)
+#define MY_SERIALIZE_REGISTER(Base, Derived, id, counter, line)                \
+  MY_SERIALIZE_REGISTER_(Base, Derived, id, counter, line)
+#define MY_SERIALIZE_REGISTER_(Base, Derived, id, counter, line)               \
+  namespace {                                                                  \
+  const bool my_serialize_registered_##counter##_##line =                      \
+      Traversal::Polymorphic<Base>::add<Derived>(id);                          \
+  }
@@ -1,10 +1,29 @@
 #include "my_serializer.h"
+#include "test_events.h"
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <climits>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
 #include <iostream>
 #include <list>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <set>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
 #include <vector>
 
 void check(bool flag, const std::string& info = "")
@@ -33,9 +52,87 @@ struct UserDefinedType {
 
 // User need to declare thier type as follows for macro expansion
 // MY_SERIALIZE(Typename, Number of fields, field1, field2 ...)
-// Support up to 16 fields
+// Plain aggregates work without it, see WideRecord
 MY_SERIALIZE(UserDefinedType, 3, idx, name, data)
 
+// Type with a fixed serialized size
+struct Point {
+  int x;
+  int y;
+};
+MY_SERIALIZE(Point, 2, x, y)
+
+struct Flags {
+  int id;
+  bool on;
+  bool operator==(const Flags&) const = default;
+};
+MY_SERIALIZE(Flags, 2, id, on)
+
+// Node of a linked structure, may point back to itself
+struct GraphNode {
+  int id;
+  std::shared_ptr<GraphNode> next;
+};
+MY_SERIALIZE(GraphNode, 2, id, next)
+
+// Record with optional fields and alternatives
+struct Record {
+  int id = 0;
+  std::optional<int> count;
+  std::optional<std::string> label;
+  std::optional<double> score;
+  std::variant<int, std::string> value;
+  std::tuple<int, char> extra;
+
+  bool operator==(const Record& other) const = default;
+};
+MY_SERIALIZE(Record, 6, id, count, label, score, value, extra)
+
+// Plain aggregates with more than 16 fields, no macro needed
+struct Span {
+  int begin, end;
+
+  bool operator==(const Span& other) const = default;
+};
+struct WideRecord {
+  int f1, f2, f3, f4, f5, f6, f7, f8, f9, f10;
+  double f11, f12, f13, f14, f15, f16, f17, f18;
+  std::string name;
+  std::vector<int> values;
+  std::optional<std::string> note;
+  Span span;
+
+  bool operator==(const WideRecord& other) const = default;
+};
+
+// Memory resource counting the allocations that reach it
+struct CountingResource : std::pmr::memory_resource {
+  size_t allocations = 0;
+
+  void* do_allocate(size_t bytes, size_t align) override
+  {
+    allocations++;
+    return std::pmr::new_delete_resource()->allocate(bytes, align);
+  }
+  void do_deallocate(void* ptr, size_t bytes, size_t align) override
+  {
+    std::pmr::new_delete_resource()->deallocate(ptr, bytes, align);
+  }
+  bool do_is_equal(const memory_resource& other) const noexcept override
+  {
+    return this == &other;
+  }
+};
+
+// Only some fields serialized, listed without a count
+struct Cache {
+  std::string key;
+  std::vector<int> hits;
+  size_t lookups = 0; // Not serialized
+};
+MY_SERIALIZE_FIELDS(Cache, key, hits)
+
 int main()
 {
   try {
@@ -97,6 +194,13 @@ int main()
       UserDefinedType u2;
       deserialize(u2, "test.data");
       check(u1 == u2, "User-defined type");
+
+      // Nested user-defined type
+      std::vector<UserDefinedType> vu1 = {u1, {1, "KAREN", {}}};
+      serialize(vu1, "test.data");
+      std::vector<UserDefinedType> vu2;
+      deserialize(vu2, "test.data");
+      check(vu1 == vu2, "vector<User-defined type>");
     }
 
     /* XML SERIALIZATION */
@@ -157,6 +261,13 @@ int main()
       UserDefinedType u2;
       deserialize_xml(u2, "test.xml");
       check(u1 == u2, "User-defined type");
+
+      // Nested user-defined type
+      std::vector<UserDefinedType> vu1 = {u1, {1, "KAREN", {}}};
+      serialize_xml(vu1, "test.xml");
+      std::vector<UserDefinedType> vu2;
+      deserialize_xml(vu2, "test.xml");
+      check(vu1 == vu2, "vector<User-defined type>");
     }
 
     /* XML SERIALIZATION BINARY VERSION */
@@ -217,10 +328,1217 @@ int main()
       UserDefinedType u2;
       deserialize_xml_base64(u2, "test.bxml");
       check(u1 == u2, "User-defined type");
+
+      // Nested user-defined type
+      std::vector<UserDefinedType> vu1 = {u1, {1, "KAREN", {}}};
+      serialize_xml_base64(vu1, "test.bxml");
+      std::vector<UserDefinedType> vu2;
+      deserialize_xml_base64(vu2, "test.bxml");
+      check(vu1 == vu2, "vector<User-defined type>");
+    }
+
+    /* MAPPED MAP */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Mapped map..." << std::endl;
+
+      std::map<int, std::string> m1;
+      for (int i = 0; i < 1000; i++) {
+        m1[i * 2] = "value" + std::to_string(i);
+      }
+      serialize_mapped(m1, "test.smap", 16);
+      MappedMap<int, std::string> mm("test.smap");
+      check(mm.size() == m1.size(), "size");
+      check(mm.find(500) != mm.end() && mm.find(500)->second == m1[500],
+            "find");
+      check(mm.find(501) == mm.end() && mm.find(-1) == mm.end() &&
+                mm.find(5000) == mm.end(),
+            "find missing");
+      check(mm.lower_bound(501)->first == 502 &&
+                mm.upper_bound(502)->first == 504 &&
+                mm.lower_bound(1999) == mm.end(),
+            "lower_bound/upper_bound");
+      std::map<int, std::string> m2(mm.begin(), mm.end());
+      check(m1 == m2, "iteration");
+      check(mm.contains(500) && !mm.contains(501), "contains");
+
+      // Values other than arithmetic types and strings use a cursor
+      std::map<std::string, std::vector<int>> m3;
+      for (int i = 0; i < 100; i++) {
+        m3["key" + std::to_string(i)] = std::vector<int>(i % 7, i);
+      }
+      serialize_mapped(m3, "test.smap", 8);
+      MappedMap<std::string, std::vector<int>> mv("test.smap");
+      std::map<std::string, std::vector<int>> m4(mv.begin(), mv.end());
+      check(m3 == m4 && mv.find("key42")->second == m3["key42"] &&
+                !mv.contains("key420"),
+            "nested values");
+
+      // Every write fails on /dev/full (ENOSPC)
+      if (std::ifstream("/dev/full").good()) {
+        bool thrown = false;
+        try {
+          serialize_mapped(m1, "/dev/full");
+        } catch (MyErr&) {
+          thrown = true;
+        }
+        check(thrown, "write error");
+      }
+    }
+
+    /* FRAMED BINARY */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Framed binary mode..." << std::endl;
+
+      BinaryOptions framed;
+      framed.framed = true;
+      framed.chunk_size = 64; // Force several chunks
+
+      UserDefinedType u1 = {233, "YANAMI", {1.2, 2.3, 3.4}};
+      serialize(u1, "test.fdata", framed);
+      UserDefinedType u2;
+      deserialize(u2, "test.fdata", framed);
+      check(u1 == u2, "User-defined type");
+
+      std::vector<std::string> vs1(100, "chunked");
+      serialize(vs1, "test.fdata", framed);
+      std::vector<std::string> vs2;
+      deserialize(vs2, "test.fdata", framed);
+      check(vs1 == vs2, "multiple chunks");
+
+      // Flip one payload byte
+      std::string raw;
+      {
+        std::ifstream fin("test.fdata", std::ios::binary);
+        raw.assign(std::istreambuf_iterator<char>(fin),
+                   std::istreambuf_iterator<char>());
+      }
+      auto rewrite = [](const std::string& bytes) {
+        std::ofstream fout("test.fdata", std::ios::binary | std::ios::trunc);
+        fout.write(bytes.data(), bytes.size());
+      };
+      auto load_fails = [&]() {
+        try {
+          deserialize(vs2, "test.fdata", framed);
+        } catch (MyErr&) {
+          return true;
+        }
+        return false;
+      };
+      std::string corrupted = raw;
+      corrupted[raw.size() / 2] ^= 0x20;
+      rewrite(corrupted);
+      check(load_fails(), "checksum mismatch");
+
+      rewrite(raw.substr(0, raw.size() - 8)); // Drop the end chunk
+      check(load_fails(), "truncated file");
+    }
+
+    /* COMPRESSED BINARY */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Compressed binary mode..." << std::endl;
+
+      BinaryOptions packed;
+      packed.codec = std::make_shared<LZCodec>();
+      packed.block_size = 4096;
+
+      std::vector<std::string> vs1;
+      for (int i = 0; i < 5000; i++) {
+        vs1.push_back("label_" + std::to_string(i % 7));
+      }
+      serialize(vs1, "test.data");
+      std::ifstream raw_file("test.data", std::ios::binary | std::ios::ate);
+      size_t raw_size = raw_file.tellg();
+      serialize(vs1, "test.zdata", packed);
+      std::ifstream packed_file("test.zdata", std::ios::binary | std::ios::ate);
+      size_t packed_size = packed_file.tellg();
+      std::vector<std::string> vs2;
+      deserialize(vs2, "test.zdata", packed);
+      check(vs1 == vs2 && packed_size * 4 < raw_size, "compressible data");
+
+      // Incompressible blocks are stored as is
+      std::vector<int> vi1;
+      unsigned seed = 12345;
+      for (int i = 0; i < 10000; i++) {
+        seed = seed * 1103515245 + 12345;
+        vi1.push_back(static_cast<int>(seed));
+      }
+      serialize(vi1, "test.zdata", packed);
+      std::vector<int> vi2;
+      deserialize(vi2, "test.zdata", packed);
+      check(vi1 == vi2, "incompressible data");
+
+      // Blocks compressed on several threads, on top of checksums
+      packed.threads = 4;
+      packed.framed = true;
+      serialize(vs1, "test.zdata", packed);
+      vs2.clear();
+      deserialize(vs2, "test.zdata", packed);
+      check(vs1 == vs2, "parallel + framed");
+
+      UserDefinedType u1 = {233, "YANAMI", {1.2, 2.3, 3.4}};
+      serialize(u1, "test.zdata", packed);
+      UserDefinedType u2;
+      deserialize(u2, "test.zdata", packed);
+      check(u1 == u2, "User-defined type");
+
+      // A block longer than the block size is a corrupted header
+      packed.framed = false;
+      serialize(vs1, "test.zdata", packed);
+      packed.block_size = 1024;
+      bool thrown = false;
+      try {
+        deserialize(vs2, "test.zdata", packed);
+      } catch (MyErr&) {
+        thrown = true;
+      }
+      check(thrown, "oversized block");
+    }
+
+    /* COLUMNAR BINARY */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Columnar binary mode..." << std::endl;
+
+      BinaryOptions columnar;
+      columnar.columnar = true;
+
+      std::vector<UserDefinedType> vu1;
+      for (int i = 0; i < 100; i++) {
+        vu1.push_back({i, "name" + std::to_string(i), {i * 0.5, i * 1.5}});
+      }
+      serialize(vu1, "test.cdata", columnar);
+      std::vector<UserDefinedType> vu2;
+      deserialize(vu2, "test.cdata", columnar);
+      check(vu1 == vu2, "vector<User-defined type>");
+
+      std::vector<int> idx;
+      deserialize_column(idx, &UserDefinedType::idx, "test.cdata", columnar);
+      std::vector<std::string> names;
+      deserialize_column(names, &UserDefinedType::name, "test.cdata",
+                         columnar);
+      check(idx.size() == 100 && idx[42] == 42 && names.size() == 100 &&
+                names[99] == "name99",
+            "single column");
+
+      // A recorded column size that does not match its values
+      {
+        std::fstream file("test.cdata",
+                          std::ios::binary | std::ios::in | std::ios::out);
+        size_t name_bytes; // After the length and the idx column
+        file.seekg(2 * sizeof(size_t) + 100 * sizeof(int));
+        file.read(reinterpret_cast<char*>(&name_bytes), sizeof(name_bytes));
+        name_bytes--;
+        file.seekp(2 * sizeof(size_t) + 100 * sizeof(int));
+        file.write(reinterpret_cast<const char*>(&name_bytes),
+                   sizeof(name_bytes));
+      }
+      bool thrown = false;
+      try {
+        deserialize(vu2, "test.cdata", columnar);
+      } catch (MyErr&) {
+        thrown = true;
+      }
+      check(thrown, "corrupted column size");
+
+      std::vector<Flags> flags1;
+      for (int i = 0; i < 50; i++) {
+        flags1.push_back({i, i % 3 == 0});
+      }
+      serialize(flags1, "test.cdata", columnar);
+      std::vector<Flags> flags2;
+      deserialize(flags2, "test.cdata", columnar);
+      std::vector<bool> on;
+      deserialize_column(on, &Flags::on, "test.cdata", columnar);
+      check(flags1 == flags2 && on.size() == 50 && on[3] && !on[4],
+            "bool column");
+
+      columnar.codec = std::make_shared<LZCodec>();
+      std::vector<std::vector<double>> data;
+      serialize(vu1, "test.cdata", columnar);
+      deserialize_column(data, &UserDefinedType::data, "test.cdata", columnar);
+      check(data.size() == 100 && data[10] == vu1[10].data,
+            "single column (compressed)");
+    }
+
+    /* SORTED INTEGER KEYS */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Integer key encodings..." << std::endl;
+
+      std::set<int> ids1;
+      for (int i = -500; i < 100000; i += 3) {
+        ids1.insert(i);
+      }
+      std::map<int64_t, std::string> ts1;
+      for (int64_t t = 1700000000000; t < 1700000100000; t += 1000) {
+        ts1[t] = "tick";
+      }
+      std::set<int64_t> sparse1 = {INT64_MIN, -1, 0, 1, INT64_MAX};
+
+      serialize(ids1, "test.data");
+      std::ifstream raw_file("test.data", std::ios::binary | std::ios::ate);
+      size_t raw_size = raw_file.tellg();
+
+      for (KeyEncoding encoding : {KeyEncoding::delta, KeyEncoding::packed}) {
+        BinaryOptions options;
+        options.key_encoding = encoding;
+        std::string name =
+            encoding == KeyEncoding::delta ? "delta " : "packed ";
+
+        serialize(ids1, "test.kdata", options);
+        std::ifstream file("test.kdata", std::ios::binary | std::ios::ate);
+        size_t size = file.tellg();
+        std::set<int> ids2;
+        deserialize(ids2, "test.kdata", options);
+        check(ids1 == ids2 && size * 3 < raw_size, name + "set<int>");
+
+        serialize(ts1, "test.kdata", options);
+        std::map<int64_t, std::string> ts2;
+        deserialize(ts2, "test.kdata", options);
+        check(ts1 == ts2, name + "map<int64_t, string>");
+
+        serialize(sparse1, "test.kdata", options);
+        std::set<int64_t> sparse2;
+        deserialize(sparse2, "test.kdata", options);
+        check(sparse1 == sparse2, name + "full range keys");
+      }
+    }
+
+    /* STRING TABLE */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: String table..." << std::endl;
+
+      std::vector<std::pair<std::string, int>> labels1;
+      for (int i = 0; i < 3000; i++) {
+        labels1.push_back({"category_" + std::to_string(i % 5), i});
+      }
+      serialize(labels1, "test.data");
+      std::ifstream raw_file("test.data", std::ios::binary | std::ios::ate);
+      size_t raw_size = raw_file.tellg();
+
+      BinaryOptions table;
+      table.string_table = true;
+      serialize(labels1, "test.sdata", table);
+      std::ifstream file("test.sdata", std::ios::binary | std::ios::ate);
+      size_t size = file.tellg();
+      std::vector<std::pair<std::string, int>> labels2;
+      deserialize(labels2, "test.sdata", table);
+      check(labels1 == labels2 && size * 2 < raw_size, "repeated strings");
+
+      // Views into a shared arena, one copy per distinct string
+      table.strings = std::make_shared<StringArena>();
+      std::vector<std::pair<std::string_view, int>> views;
+      deserialize(views, "test.sdata", table);
+      check(views.size() == labels1.size() && views[7].first == "category_2" &&
+                views[2].first.data() == views[7].first.data() &&
+                table.strings->size() == 5,
+            "string_view in arena");
+      std::vector<std::pair<std::string_view, int>> xml_views;
+      XMLSerialize::serialize_xml(views, "test.xml");
+      XMLSerialize::deserialize_xml(xml_views, "test.xml", table.strings);
+      check(xml_views == views &&
+                xml_views[7].first.data() == views[7].first.data(),
+            "string_view in arena (XML)");
+
+      // Columns keep their own table so they can be read separately
+      table.columnar = true;
+      std::vector<UserDefinedType> vu1(50, {1, "same", {}});
+      serialize(vu1, "test.sdata", table);
+      std::vector<UserDefinedType> vu2;
+      deserialize(vu2, "test.sdata", table);
+      std::vector<std::string> names;
+      deserialize_column(names, &UserDefinedType::name, "test.sdata", table);
+      check(vu1 == vu2 && names == std::vector<std::string>(50, "same"),
+            "columnar");
+    }
+
+    /* FLOAT SERIES */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Gorilla float encoding..." << std::endl;
+
+      std::vector<double> metric1;
+      for (int i = 0; i < 10000; i++) {
+        metric1.push_back(20.0 + (i / 100) * 0.25);
+      }
+      serialize(metric1, "test.data");
+      std::ifstream raw_file("test.data", std::ios::binary | std::ios::ate);
+      size_t raw_size = raw_file.tellg();
+
+      BinaryOptions gorilla;
+      gorilla.float_encoding = FloatEncoding::gorilla;
+      serialize(metric1, "test.gdata", gorilla);
+      std::ifstream file("test.gdata", std::ios::binary | std::ios::ate);
+      size_t size = file.tellg();
+      std::vector<double> metric2;
+      deserialize(metric2, "test.gdata", gorilla);
+      check(metric1 == metric2 && size * 10 < raw_size, "vector<double>");
+
+      std::vector<float> noisy1;
+      unsigned seed = 7;
+      for (int i = 0; i < 1000; i++) {
+        seed = seed * 1103515245 + 12345;
+        noisy1.push_back(static_cast<float>(seed % 1000) / 7.0f);
+      }
+      serialize(noisy1, "test.gdata", gorilla);
+      std::vector<float> noisy2;
+      deserialize(noisy2, "test.gdata", gorilla);
+      check(noisy1 == noisy2, "vector<float>");
+
+      // Per field codec, special values keep their bits
+      FloatSeries<double> special1 = {0.0, -0.0, 1e308, -1e-308,
+                                      INFINITY, -INFINITY, NAN, 1.0};
+      serialize(special1, "test.gdata");
+      FloatSeries<double> special2;
+      deserialize(special2, "test.gdata");
+      check(special2.size() == special1.size() &&
+                std::memcmp(special1.data(), special2.data(),
+                            special1.size() * sizeof(double)) == 0,
+            "FloatSeries special values");
+    }
+
+    /* BIT PACKING */
+    {
+      using namespace BinarySerialize;
+      using namespace XMLSerialize;
+      std::cout << "Testing: Bit packing..." << std::endl;
+
+      std::vector<bool> flags1;
+      for (int i = 0; i < 1001; i++) {
+        flags1.push_back(i % 3 == 0);
+      }
+      serialize(flags1, "test.data");
+      std::ifstream flag_file("test.data", std::ios::binary | std::ios::ate);
+      size_t flag_size = flag_file.tellg();
+      std::vector<bool> flags2;
+      deserialize(flags2, "test.data");
+      check(flags1 == flags2 && flag_size == sizeof(size_t) + 126,
+            "vector<bool>");
+      flags2.clear();
+      serialize_xml(flags1, "test.xml");
+      deserialize_xml(flags2, "test.xml");
+      check(flags1 == flags2, "vector<bool> (XML)");
+
+      std::bitset<70> bits1;
+      bits1.set(0).set(33).set(69);
+      serialize(bits1, "test.data");
+      std::bitset<70> bits2;
+      deserialize(bits2, "test.data");
+      check(bits1 == bits2, "bitset");
+      bits2.reset();
+      serialize_xml_base64(bits1, "test.bxml");
+      deserialize_xml_base64(bits2, "test.bxml");
+      check(bits1 == bits2, "bitset (XML)");
+
+      BinaryOptions packed;
+      packed.pack_integers = true;
+      std::vector<int> categories1;
+      for (int i = 0; i < 1000; i++) {
+        categories1.push_back(-3 + i % 11);
+      }
+      serialize(categories1, "test.pdata", packed);
+      std::ifstream file("test.pdata", std::ios::binary | std::ios::ate);
+      size_t size = file.tellg();
+      std::vector<int> categories2;
+      deserialize(categories2, "test.pdata", packed);
+      check(categories1 == categories2 && size * 7 < 1000 * sizeof(int),
+            "packed vector<int>");
+
+      std::vector<int64_t> wide1 = {INT64_MIN, 0, INT64_MAX, -5};
+      serialize(wide1, "test.pdata", packed);
+      std::vector<int64_t> wide2;
+      deserialize(wide2, "test.pdata", packed);
+      check(wide1 == wide2, "packed vector<int64_t> (full range)");
+    }
+
+    /* SERIALIZED SIZE */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Serialized size..." << std::endl;
+
+      static_assert(serialized_size(std::pair<int, double>{}) == 12);
+      static_assert(serialized_size(Point{1, 2}) == 2 * sizeof(int));
+      static_assert(fixed_size_v<UserDefinedType> == 0);
+
+      std::map<std::string, std::vector<std::pair<int, double>>> m1 = {
+          {"a", {{1, 1.0}, {2, 2.0}}}, {"bb", {}}};
+      serialize(m1, "test.data");
+      std::ifstream file("test.data", std::ios::binary | std::ios::ate);
+      check(serialized_size(m1) == static_cast<size_t>(file.tellg()),
+            "nested containers");
+
+      BinaryOptions options;
+      options.string_table = true;
+      options.codec = std::make_shared<LZCodec>();
+      std::vector<char> bytes = serialize_to_memory(m1, options);
+      check(bytes.size() == serialized_size(m1, options), "with options");
+      std::map<std::string, std::vector<std::pair<int, double>>> m2;
+      deserialize_from_memory(m2, bytes.data(), bytes.size(), options);
+      check(m1 == m2, "memory round trip");
+
+      UserDefinedType u1 = {233, "YANAMI", {1.2, 2.3, 3.4}};
+      BinaryOptions prealloc;
+      prealloc.preallocate = true;
+      serialize(u1, "test.data", prealloc);
+      std::ifstream u_file("test.data", std::ios::binary | std::ios::ate);
+      UserDefinedType u2;
+      deserialize(u2, "test.data");
+      check(u1 == u2 && serialized_size(u1) ==
+                            static_cast<size_t>(u_file.tellg()),
+            "preallocated file");
+    }
+
+    /* GENERIC CONTAINERS */
+    {
+      using namespace BinarySerialize;
+      using namespace XMLSerialize;
+      std::cout << "Testing: Generic containers..." << std::endl;
+
+      std::unordered_map<std::string, int> hash1 = {{"a", 1}, {"b", 2}};
+      std::unordered_set<int> hash_set1 = {3, 1, 4, 15};
+      std::deque<std::string> deque1 = {"x", "", "yz"};
+      std::multimap<int, std::string> multi1 = {{1, "a"}, {1, "b"}, {0, "c"}};
+      std::array<int, 3> array1 = {7, 8, 9};
+      std::tuple<int, std::string, double> tuple1 = {1, "two", 3.0};
+      int c_array1[4] = {1, 2, 3, 4};
+      static_assert(serialized_size(std::array<int, 3>{}) == 3 * sizeof(int));
+
+      auto all1 = std::make_tuple(hash1, hash_set1, deque1, multi1, array1,
+                                  tuple1);
+      decltype(all1) all2;
+      serialize(all1, "test.data");
+      deserialize(all2, "test.data");
+      check(all1 == all2, "Binary");
+      std::get<0>(all2).clear();
+      std::get<3>(all2).clear();
+      serialize_xml(all1, "test.xml");
+      deserialize_xml(all2, "test.xml");
+      check(all1 == all2, "XML");
+
+      int c_array2[4] = {};
+      serialize(c_array1, "test.data");
+      deserialize(c_array2, "test.data");
+      std::ifstream file("test.data", std::ios::binary | std::ios::ate);
+      check(std::equal(c_array1, c_array1 + 4, c_array2) &&
+                file.tellg() == 4 * sizeof(int),
+            "C array without length");
+    }
+
+    /* PMR CONTAINERS */
+    {
+      using namespace BinarySerialize;
+      using namespace XMLSerialize;
+      std::cout << "Testing: std::pmr containers..." << std::endl;
+
+      using Tags = std::pmr::map<std::pmr::string,
+                                 std::pmr::vector<std::pmr::string>>;
+      Tags tags1 = {{"first key, long enough to allocate", {"a", "b"}},
+                    {"second key, long enough to allocate", {}}};
+      serialize(tags1, "test.data");
+      serialize_xml(tags1, "test.xml");
+
+      // Everything has to come from the arena, never from the default
+      std::pmr::monotonic_buffer_resource arena;
+      std::pmr::memory_resource* heap =
+          std::pmr::set_default_resource(std::pmr::null_memory_resource());
+      bool in_arena = true;
+      Tags tags2(&arena), tags3(&arena);
+      try {
+        deserialize(tags2, "test.data");
+        deserialize_xml(tags3, "test.xml");
+      } catch (std::bad_alloc&) {
+        in_arena = false;
+      }
+      std::pmr::set_default_resource(heap);
+      check(in_arena && tags1 == tags2 && tags1 == tags3, "loaded into arena");
+
+      // Encoded keys and patches build their entries in the arena as well
+      using Names = std::pmr::map<int, std::pmr::string>;
+      Names names1 = {{1, "first name, long enough to allocate"},
+                      {4, "second name, long enough to allocate"}};
+      Names names2 = names1;
+      names2[9] = "added name, long enough to allocate";
+      BinaryOptions delta;
+      delta.key_encoding = KeyEncoding::delta;
+      serialize(names1, "test.kdata", delta);
+      serialize_patch(names1, names2, "test.ddata");
+      CountingResource upstream;
+      std::pmr::monotonic_buffer_resource names_arena(&upstream);
+      CountingResource fallback;
+      heap = std::pmr::set_default_resource(&fallback);
+      Names names3(&names_arena);
+      deserialize(names3, "test.kdata", delta);
+      bool loaded = names3 == names1;
+      apply_patch(names3, "test.ddata");
+      std::pmr::set_default_resource(heap);
+      check(loaded && names3 == names2 && fallback.allocations == 0 &&
+                upstream.allocations > 0,
+            "encoded keys and patches in arena");
+    }
+
+    /* SMART POINTERS */
+    {
+      using namespace BinarySerialize;
+      using namespace XMLSerialize;
+      std::cout << "Testing: Smart pointers..." << std::endl;
+
+      auto mesh = std::make_shared<std::vector<int>>(1000, 7);
+      std::vector<std::shared_ptr<std::vector<int>>> scene1 = {mesh, nullptr,
+                                                               mesh, mesh};
+      serialize(scene1, "test.data");
+      std::ifstream file("test.data", std::ios::binary | std::ios::ate);
+      decltype(scene1) scene2;
+      deserialize(scene2, "test.data");
+      size_t size = file.tellg();
+      check(scene2.size() == 4 && *scene2[0] == *mesh && !scene2[1] &&
+                scene2[0] == scene2[2] && scene2[0] == scene2[3] &&
+                serialized_size(scene1) == size && size < 2000 * sizeof(int),
+            "shared objects written once");
+      decltype(scene1) scene3;
+      serialize_xml(scene1, "test.xml");
+      deserialize_xml(scene3, "test.xml");
+      check(*scene3[0] == *mesh && scene3[0] == scene3[3], "shared (XML)");
+
+      std::pair<std::unique_ptr<std::string>, std::unique_ptr<int>> unique1 = {
+          std::make_unique<std::string>("owned"), nullptr};
+      decltype(unique1) unique2 = {nullptr, std::make_unique<int>(1)};
+      serialize(unique1, "test.data");
+      deserialize(unique2, "test.data");
+      check(*unique2.first == "owned" && !unique2.second, "unique_ptr");
+
+      auto ring1 = std::make_shared<GraphNode>(GraphNode{1, nullptr});
+      ring1->next = std::make_shared<GraphNode>(GraphNode{2, ring1});
+      std::shared_ptr<GraphNode> ring2;
+      serialize_xml_base64(ring1, "test.bxml");
+      deserialize_xml_base64(ring2, "test.bxml");
+      check(ring2->id == 1 && ring2->next->id == 2 &&
+                ring2->next->next == ring2,
+            "cycle");
+      ring1->next->next.reset(); // Break the cycles
+      ring2->next->next.reset();
+    }
+
+    /* POLYMORPHIC TYPES */
+    {
+      using namespace BinarySerialize;
+      using namespace XMLSerialize;
+      std::cout << "Testing: Polymorphic types..." << std::endl;
+
+      std::vector<std::unique_ptr<Event>> events1;
+      auto click = std::make_unique<Click>();
+      click->time = 0.5;
+      click->x = 3;
+      click->y = 4;
+      auto key = std::make_unique<KeyPress>();
+      key->time = 1.5;
+      key->key = "Enter";
+      events1.push_back(std::move(click));
+      events1.push_back(nullptr);
+      events1.push_back(std::move(key));
+      auto same = [&](const std::vector<std::unique_ptr<Event>>& events2) {
+        auto* c = dynamic_cast<Click*>(events2[0].get());
+        auto* k = dynamic_cast<KeyPress*>(events2[2].get());
+        return events2.size() == 3 && c && c->time == 0.5 && c->x == 3 &&
+               c->y == 4 && !events2[1] && k && k->time == 1.5 &&
+               k->key == "Enter";
+      };
+      std::vector<std::unique_ptr<Event>> events2;
+      serialize(events1, "test.data");
+      deserialize(events2, "test.data");
+      check(same(events2), "Binary");
+      std::vector<std::unique_ptr<Event>> events3;
+      serialize_xml(events1, "test.xml");
+      deserialize_xml(events3, "test.xml");
+      check(same(events3), "XML");
+
+      events1.push_back(std::make_unique<Event>()); // Not registered
+      bool thrown = false;
+      try {
+        serialize(events1, "test.data");
+      } catch (MyErr&) {
+        thrown = true;
+      }
+      check(thrown, "unregistered type");
+
+      using Events = Traversal::Polymorphic<Event>;
+      int rejected = 0;
+      for (auto add : {&Events::add<Scroll>, &Events::add<Click>}) {
+        try {
+          add(1); // Id of KeyPress, Click registered already
+        } catch (MyErr&) {
+          rejected++;
+        }
+      }
+      check(rejected == 2 && Events::id_of<KeyPress>() == 1 &&
+                Events::id_of<Scroll>() == Events::unregistered,
+            "duplicate registration");
+
+      // Registered by both translation units, the same ids on both sides
+      std::vector<char> bytes = encode_events_elsewhere();
+      std::vector<std::unique_ptr<Event>> events4;
+      deserialize_from_memory(events4, bytes.data(), bytes.size());
+      auto* k = dynamic_cast<KeyPress*>(events4[0].get());
+      check(events4.size() == 2 && k && k->key == "Tab" &&
+                dynamic_cast<Click*>(events4[1].get()),
+            "registered in two units");
+
+      BinaryOptions columnar;
+      columnar.columnar = true;
+      std::vector<Click> clicks1(3), clicks2;
+      clicks1[1].time = 2.0;
+      serialize(clicks1, "test.cdata", columnar);
+      deserialize(clicks2, "test.cdata", columnar);
+      check(clicks2.size() == 3 && clicks2[1].time == 2.0,
+            "inherited fields (columnar)");
+    }
+
+    /* OPTIONAL AND VARIANT */
+    {
+      using namespace BinarySerialize;
+      using namespace XMLSerialize;
+      std::cout << "Testing: Optional and variant..." << std::endl;
+
+      std::vector<Record> records1(2);
+      records1[0] = {1, 5, std::nullopt, 0.5, "text", {2, 'c'}};
+      records1[1].value = 7;
+      serialize(records1, "test.data");
+      std::vector<Record> records2;
+      deserialize(records2, "test.data");
+      // id, one byte of presence flags, present fields, index and value
+      size_t size0 = 4 + 1 + 4 + 8 + 1 + (8 + 4) + 4 + 1;
+      size_t size1 = 4 + 1 + 1 + 4 + 4 + 1;
+      check(records1 == records2 &&
+                serialized_size(records1) == sizeof(size_t) + size0 + size1,
+            "Binary, packed presence flags");
+      std::vector<Record> records3(1);
+      records3[0].label = "stale";
+      serialize_xml(records1, "test.xml");
+      deserialize_xml(records3, "test.xml");
+      check(records1 == records3, "XML");
+
+      std::vector<std::optional<int>> optionals1 = {1, std::nullopt, 3};
+      std::vector<std::optional<int>> optionals2;
+      serialize(optionals1, "test.data");
+      deserialize(optionals2, "test.data");
+      check(optionals1 == optionals2, "optional");
+
+      std::variant<std::string, double, Point> variant1 = Point{1, 2};
+      std::variant<std::string, double, Point> variant2;
+      serialize_xml_base64(variant1, "test.bxml");
+      deserialize_xml_base64(variant2, "test.bxml");
+      check(std::get<Point>(variant2).y == 2, "variant");
+    }
+
+    /* AGGREGATE REFLECTION */
+    {
+      using namespace BinarySerialize;
+      using namespace XMLSerialize;
+      std::cout << "Testing: Aggregate reflection..." << std::endl;
+
+      WideRecord wide1 = {};
+      wide1.f1 = 1;
+      wide1.f10 = 10;
+      wide1.f18 = 18.5;
+      wide1.name = "wide";
+      wide1.values = {1, 2, 3};
+      wide1.note = "note";
+      wide1.span = {4, 5};
+      WideRecord wide2 = {};
+      serialize(wide1, "test.data");
+      deserialize(wide2, "test.data");
+      check(wide1 == wide2, "22 fields (Binary)");
+      WideRecord wide3 = {};
+      serialize_xml(wide1, "test.xml");
+      deserialize_xml(wide3, "test.xml");
+      check(wide1 == wide3, "22 fields (XML)");
+      static_assert(serialized_size(Span{}) == 2 * sizeof(int));
+
+      Cache cache1 = {"k", {1, 2}, 9};
+      Cache cache2;
+      serialize(cache1, "test.data");
+      deserialize(cache2, "test.data");
+      check(cache2.key == "k" && cache2.hits == cache1.hits &&
+                cache2.lookups == 0 &&
+                serialized_size(cache1) == 2 * sizeof(size_t) + 1 + 8,
+            "selected fields");
+    }
+
+    /* PATCHES */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Patches..." << std::endl;
+
+      std::map<int, std::vector<int>> map1;
+      for (int i = 0; i < 1000; i++) {
+        map1[i] = {i, i + 1, i + 2};
+      }
+      auto map2 = map1;
+      map2.erase(3);
+      map2[1000] = {7};
+      map2[5][1] = -1;
+      map2[6].push_back(9);
+      serialize_patch(map1, map2, "test.ddata");
+      size_t size = std::ifstream("test.ddata", std::ios::ate).tellg();
+      auto map3 = map1;
+      apply_patch(map3, "test.ddata");
+      check(map3 == map2 && size < 64, "map patch");
+
+      WideRecord wide1 = {};
+      wide1.values = {1, 2, 3, 4};
+      wide1.name = "before";
+      WideRecord wide2 = wide1;
+      wide2.f10 = 10;
+      wide2.values.resize(2);
+      wide2.span.end = 3;
+      serialize_patch(wide1, wide2, "test.ddata");
+      apply_patch(wide1, "test.ddata");
+      check(wide1 == wide2, "struct patch");
+
+      std::set<std::string> set1 = {"a", "b", "c"};
+      std::set<std::string> set2 = {"b", "c", "d"};
+      serialize_patch(set1, set2, "test.ddata");
+      apply_patch(set1, "test.ddata");
+      check(set1 == set2, "set patch");
+
+      Checkpoints<std::map<int, std::vector<int>>> saved("test.chain", 3);
+      for (int i = 0; i < 5; i++) {
+        map1[i].push_back(i);
+        saved.save(map1);
+        saved.save(map1); // Unchanged
+      }
+      Checkpoints<std::map<int, std::vector<int>>> loaded("test.chain", 3);
+      std::map<int, std::vector<int>> map4;
+      loaded.load(map4);
+      check(map4 == map1 && loaded.chain_length() == 1, "patch chain");
+
+      // A new base after a restart must not pick up the old chain
+      Checkpoints<std::map<int, int>> first("test.chain", 8);
+      first.save({{1, 1}});
+      first.save({{1, 1}, {2, 2}});
+      first.save({{1, 1}, {2, 2}, {3, 3}});
+      Checkpoints<std::map<int, int>> restarted("test.chain", 8);
+      restarted.save({{100, 100}});
+      Checkpoints<std::map<int, int>> reloaded("test.chain", 8);
+      std::map<int, int> map5;
+      reloaded.load(map5);
+      check(map5 == std::map<int, int>{{100, 100}} &&
+                reloaded.chain_length() == 0,
+            "chain after restart");
+
+      // A torn last patch is dropped, the chain before it still loads
+      restarted.save({{100, 100}, {101, 101}});
+      restarted.save({{100, 100}, {101, 101}, {102, 102}});
+      std::string torn;
+      {
+        std::ifstream in("test.chain.2", std::ios::binary);
+        torn.assign(std::istreambuf_iterator<char>(in), {});
+      }
+      std::ofstream("test.chain.2", std::ios::binary)
+          .write(torn.data(), torn.size() - 4);
+      reloaded.load(map5);
+      check(map5 == std::map<int, int>{{100, 100}, {101, 101}} &&
+                reloaded.chain_length() == 1,
+            "torn patch");
+
+      // A pointee changed in place between two saves is still a change
+      auto mesh = std::make_shared<std::vector<int>>(std::vector<int>{1, 2});
+      std::vector<std::shared_ptr<std::vector<int>>> scene = {mesh, mesh};
+      Checkpoints<decltype(scene)> scenes("test.chain", 8);
+      scenes.save(scene);
+      mesh->push_back(3);
+      scenes.save(scene);
+      decltype(scene) scene2;
+      Checkpoints<decltype(scene)>("test.chain", 8).load(scene2);
+      check(scene2.size() == 2 && scene2[0] && *scene2[0] == *mesh &&
+                scene2[0] == scene2[1],
+            "shared pointee changed in place");
+
+      // Polymorphic pointees are compared by type and content
+      std::vector<std::unique_ptr<Event>> clicks;
+      clicks.push_back(std::make_unique<Click>());
+      Checkpoints<decltype(clicks)> clicked("test.chain", 8);
+      clicked.save(clicks);
+      clicked.save(clicks);
+      size_t unchanged = clicked.chain_length();
+      static_cast<Click&>(*clicks[0]).x = 5;
+      clicked.save(clicks);
+      decltype(clicks) clicks2;
+      Checkpoints<decltype(clicks)>("test.chain", 8).load(clicks2);
+      check(unchanged == 0 && clicked.chain_length() == 1 &&
+                clicks2.size() == 1 &&
+                static_cast<Click&>(*clicks2[0]).x == 5,
+            "polymorphic checkpoints");
+
+      // Types holding a unique_ptr cannot be copied, still checkpointed
+      std::vector<std::unique_ptr<int>> owned;
+      owned.push_back(std::make_unique<int>(1));
+      Checkpoints<decltype(owned)> owners("test.chain", 8);
+      owners.save(owned);
+      *owned[0] = 2;
+      owners.save(owned);
+      decltype(owned) owned2;
+      Checkpoints<decltype(owned)>("test.chain", 8).load(owned2);
+      check(owned2.size() == 1 && *owned2[0] == 2, "unique_ptr checkpoints");
+    }
+
+    /* SKIP UNCHANGED */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Skip unchanged..." << std::endl;
+
+      ContentHash hash;
+      hash.update("abc", 3);
+      check(hash.digest() == 0x44bc2cf5ad770999, "content hash");
+
+      BinaryOptions options;
+      options.skip_unchanged = true;
+      std::remove("test.data.hash");
+      std::vector<int> v1 = {1, 2, 3};
+      bool first = serialize(v1, "test.data", options);
+      bool again = serialize(v1, "test.data", options);
+      v1.push_back(4);
+      bool changed = serialize(v1, "test.data", options);
+      std::vector<int> v2;
+      deserialize(v2, "test.data");
+      check(first && !again && changed && v1 == v2, "skipped rewrite");
+
+      // An unchanged save writes nothing: an edit of the same size made
+      // without drop_fingerprint survives it (the file is not read)
+      {
+        std::fstream edited("test.data",
+                            std::ios::binary | std::ios::in | std::ios::out);
+        edited.seekp(sizeof(size_t));
+        edited.put(7);
+      }
+      again = serialize(v1, "test.data", options);
+      deserialize(v2, "test.data");
+      bool kept = !again && v2[0] == 7;
+      FileIO::drop_fingerprint("test.data");
+      changed = serialize(v1, "test.data", options);
+      deserialize(v2, "test.data");
+      check(kept && changed && v1 == v2, "no write when unchanged");
+
+      // Sidecar staged and committed together with the file
+      options.atomic = true;
+      options.framed = true;
+      v1.push_back(5);
+      changed = serialize(v1, "test.data", options);
+      again = serialize(v1, "test.data", options);
+      deserialize(v2, "test.data", options);
+      check(changed && !again && v1 == v2 &&
+                !std::ifstream("test.data.hash.tmp").good(),
+            "atomic skipped rewrite");
+
+      // Other writes retire the sidecar, v3 has the size of v1
+      BinaryOptions skip;
+      skip.skip_unchanged = true;
+      std::vector<int> v3 = {9, 9, 9, 9, 9};
+      serialize(v3, "test.data", skip);
+      serialize(v1, "test.data");
+      bool rewritten = serialize(v3, "test.data", skip);
+      deserialize(v2, "test.data");
+      bool restored = rewritten && v2 == v3;
+      XMLSerialize::serialize_xml(v1, "test.data");
+      rewritten = serialize(v3, "test.data", skip);
+      deserialize(v2, "test.data");
+      check(restored && rewritten && v2 == v3, "sidecar after other writes");
+    }
+
+    /* ATOMIC SAVE */
+    {
+      using namespace BinarySerialize;
+      using namespace XMLSerialize;
+      std::cout << "Testing: Atomic save..." << std::endl;
+
+      BinaryOptions options;
+      options.atomic = true;
+      std::vector<int> v1 = {1, 2, 3}, v2;
+      serialize(v1, "test.data", options);
+      deserialize(v2, "test.data");
+      check(v1 == v2 && !std::ifstream("test.data.tmp"), "atomic save");
+
+      std::map<int, std::string> m1 = {{1, "a"}}, m2;
+      {
+        FileIO::SaveBatch batch;
+        serialize(m1, batch.stage("test.data"));
+        serialize_xml(m1, batch.stage("test.xml"));
+        batch.commit();
+      }
+      deserialize(m2, "test.data");
+      check(m1 == m2, "group commit");
+      {
+        FileIO::SaveBatch batch;
+        serialize(v1, batch.stage("test.data")); // Never committed
+      }
+      m2.clear();
+      deserialize(m2, "test.data");
+      check(m1 == m2 && !std::ifstream("test.data.tmp"), "uncommitted batch");
+
+      int errors = 0;
+      try {
+        serialize(v1, "no_such_dir/test.data");
+      } catch (MyErr&) {
+        errors++;
+      }
+      try {
+        serialize_xml(v1, "no_such_dir/test.xml");
+      } catch (MyErr&) {
+        errors++;
+      }
+      check(errors == 2, "write errors");
+    }
+
+    /* ASYNC SAVE */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Async save..." << std::endl;
+
+      std::vector<int> v1(1000, 7), v2;
+      std::future<void> done = serialize_async(v1, "test.data");
+      done.get();
+      deserialize(v2, "test.data");
+      check(v1 == v2, "future");
+
+      std::atomic<int> written = 0;
+      {
+        BackgroundWriter writer(1); // Every second call waits
+        for (int i = 0; i < 4; i++) {
+          v1[0] = i;
+          serialize_async(
+              v1, "test.data",
+              [&written](std::exception_ptr err) { written += !err; }, {},
+              writer);
+        }
+      } // Drains the queue
+      deserialize(v2, "test.data");
+      check(written == 4 && v2[0] == 3, "callbacks in order");
+
+      bool thrown = false;
+      try {
+        serialize_async(v1, "no_such_dir/test.data").get();
+      } catch (MyErr&) {
+        thrown = true;
+      }
+      check(thrown, "async write error");
+
+      // Callbacks submitting with a full queue, and a throwing one
+      thrown = false;
+      {
+        BackgroundWriter writer(1);
+        std::promise<void> chained;
+        serialize_async(
+            v1, "test.data",
+            [&](std::exception_ptr) {
+              v1[0] = 42;
+              writer.write(serialize_to_memory(v1), "test.data");
+              writer.write(serialize_to_memory(v1), "test.data", {},
+                           [&](std::exception_ptr) { chained.set_value(); });
+            },
+            {}, writer);
+        chained.get_future().get();
+        serialize_async(
+            v1, "test.data",
+            [](std::exception_ptr) { throw MyErr("callback"); }, {}, writer);
+        for (int i = 0; i < 2 && !thrown; i++) { // Second one sees it
+          try {
+            serialize_async(v1, "test.data", {}, writer).get();
+          } catch (MyErr&) {
+            thrown = true;
+          }
+        }
+      }
+      deserialize(v2, "test.data");
+      check(thrown && v2[0] == 42, "callback submits and throws");
+    }
+
+    /* ASYNC FILE I/O */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Async file I/O..." << std::endl;
+
+      BinaryOptions options;
+      options.async_io = true;
+      options.io_chunk = 4096; // Many chunks in flight
+      options.io_depth = 3;
+      std::vector<double> v1(100003), v2;
+      for (size_t i = 0; i < v1.size(); i++) {
+        v1[i] = i * 0.5;
+      }
+      serialize(v1, "test.data", options);
+      deserialize(v2, "test.data", options);
+      check(v1 == v2, "async round trip");
+
+      std::map<std::string, std::vector<int>> m1, m2;
+      for (int i = 0; i < 2000; i++) {
+        m1[std::to_string(i)] = {i, -i};
+      }
+      options.framed = true;
+      options.codec = std::make_shared<LZCodec>();
+      serialize(m1, "test.data", options);
+      deserialize(m2, "test.data", options);
+      check(m1 == m2, "async with stages");
+
+      BinaryOptions direct;
+      direct.direct_io = true;
+      direct.io_chunk = 10000; // Rounded up to whole blocks
+      std::vector<double> v3;
+      serialize(v1, "test.data", direct);
+      size_t size = std::ifstream("test.data", std::ios::ate).tellg();
+      deserialize(v3, "test.data", direct);
+      check(v1 == v3 && size == serialized_size(v1), "direct I/O");
+
+      BinaryOptions pipelined;
+      pipelined.pipelined = true;
+      pipelined.io_chunk = 4096;
+      pipelined.io_depth = 2; // Double buffering
+      m2.clear();
+      serialize(m1, "test.data", pipelined);
+      deserialize(m2, "test.data", pipelined);
+      pipelined.direct_io = true;
+      std::vector<double> v4;
+      serialize(v1, "test.data", pipelined);
+      deserialize(v4, "test.data", pipelined);
+      check(m1 == m2 && v1 == v4, "pipelined I/O thread");
+    }
+
+    /* RECORD LOG */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Record log..." << std::endl;
+
+      std::remove("test.log");
+      {
+        RecordLog log("test.log", 256); // Small blocks
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+          threads.emplace_back([&log, t] {
+            for (int i = 0; i < 1000; i++) {
+              log.append(UserDefinedType{t, std::to_string(i), {double(i)}});
+            }
+            log.flush();
+          });
+        }
+        for (std::thread& thread : threads) {
+          thread.join();
+        }
+        log.append(UserDefinedType{9, "last", {}});
+      } // Writes the last record
+      std::vector<int> next(4, 0);
+      size_t count = 0;
+      bool ordered = true;
+      RecordLog::replay<UserDefinedType>(
+          "test.log", [&](UserDefinedType record) {
+            count++;
+            if (record.idx < 4) {
+              ordered = ordered && record.data[0] == next[record.idx]++;
+            }
+          });
+      check(count == 4001 && ordered, "many writers");
+
+      {
+        std::ofstream torn("test.log", std::ios::binary | std::ios::app);
+        torn.write("\x40\0\0\0\1\0", 6); // Crash in the middle of a block
+      }
+      count = 0;
+      RecordLog::replay<UserDefinedType>(
+          "test.log", [&](UserDefinedType) { count++; });
+      check(count == 4001, "torn tail");
+
+      // Block lengths are 32 bit
+      bool thrown = false;
+      try {
+        RecordLog too_large("test.log", size_t(UINT32_MAX) + 1);
+      } catch (MyErr&) {
+        thrown = true;
+      }
+      check(thrown, "block size limit");
+    }
+
+    /* SHARED MEMORY RING */
+    {
+      using namespace BinarySerialize;
+      std::cout << "Testing: Shared memory ring..." << std::endl;
+
+      SharedRing sender("/my_serializer_test", 4096); // Wraps and waits a lot
+      SharedRing receiver("/my_serializer_test");
+      std::thread producer([&sender] {
+        for (int i = 0; i < 5000; i++) {
+          sender.send(std::vector<int>(i % 300, i));
+        }
+        sender.send(std::string("done"));
+      });
+      bool same = true;
+      for (int i = 0; i < 5000; i++) {
+        std::vector<int> v;
+        receiver.receive(v);
+        same = same && v == std::vector<int>(i % 300, i);
+      }
+      std::string last;
+      receiver.view([&last](const char* bytes, size_t len) {
+        deserialize_from_memory(last, bytes, len); // In place
+      });
+      producer.join();
+      check(same && last == "done", "ring transport");
+
+      BinaryOptions framed;
+      framed.framed = true;
+      framed.key_encoding = KeyEncoding::delta;
+      std::set<int> keys = {1, 5, 9, 1000};
+      for (int i = 0; i < 3; i++) { // Reuses the sender's buffer
+        sender.send(keys, framed);
+      }
+      std::set<int> keys2;
+      for (int i = 0; i < 3; i++) {
+        keys2.clear();
+        receiver.receive(keys2, framed);
+      }
+      check(keys2 == keys, "ring with options");
+
+      // A message the receiver fails on is dropped, the next one still comes
+      sender.send(std::string("bad"));
+      sender.send(std::string("good"));
+      bool thrown = false;
+      try {
+        receiver.view([](const char*, size_t) { throw MyErr("rejected"); });
+      } catch (MyErr&) {
+        thrown = true;
+      }
+      std::string next;
+      receiver.receive(next);
+      check(thrown && next == "good", "ring after a failed receive");
+    }
+
+    /* TRAVERSAL */
+    {
+      std::cout << "Testing: Traversal..." << std::endl;
+
+      static_assert(Traversal::Archive<BinarySerialize::BinarySerializer>);
+      static_assert(Traversal::Archive<BinarySerialize::BinaryDeserializer>);
+      static_assert(Traversal::Archive<BinarySerialize::SizeCounter>);
+      static_assert(Traversal::Archive<XMLSerialize::XMLSerializer>);
+      static_assert(Traversal::Archive<XMLSerialize::XMLDeserializer>);
+
+      {
+        std::ofstream xml("test.xml");
+        xml << "<serialization><field><vector><length val=\"2\"/>"
+               "<item val=\"1\"/></vector></field></serialization>";
+      }
+      std::vector<int> v;
+      bool thrown = false;
+      try {
+        XMLSerialize::deserialize_xml(v, "test.xml");
+      } catch (MyErr&) {
+        thrown = true;
+      }
+      check(thrown, "missing XML item");
     }
   } catch (MyErr& err) {
     std::cout << "Error: " << err.what() << std::endl;
   } catch (...) {
     std::cout << "Unknown error." << std::endl;
   }
-}
\ No newline at end of file
+}
\ No newline at end of file
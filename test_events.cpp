@@ -0,0 +1,13 @@
+#include "test_events.h"
+#include <memory>
+#include <vector>
+
+std::vector<char> encode_events_elsewhere()
+{
+  std::vector<std::unique_ptr<Event>> events;
+  auto key = std::make_unique<KeyPress>();
+  key->key = "Tab";
+  events.push_back(std::move(key));
+  events.push_back(std::make_unique<Click>());
+  return BinarySerialize::serialize_to_memory(events);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "my_serializer.h"
+#include <string>
+#include <vector>
+
+// Polymorphic types, stored through pointers to Event
+// Registered in this header, so every translation unit including it
+// registers them again
+struct Event {
+  virtual ~Event() = default;
+  double time = 0;
+};
+struct Click : Event {
+  int x = 0;
+  int y = 0;
+};
+struct KeyPress : Event {
+  std::string key;
+};
+struct Scroll : Event { // Only registered by the tests
+  int dy = 0;
+};
+MY_SERIALIZE(Click, 3, time, x, y)
+MY_SERIALIZE(KeyPress, 2, time, key)
+MY_SERIALIZE(Scroll, 2, time, dy)
+// On one line, like two headers using the macro on the same line number
+MY_SERIALIZE_DERIVED(Event, Click, 0) MY_SERIALIZE_DERIVED(Event, KeyPress, 1)
+
+// Events encoded by another translation unit (test_events.cpp)
+std::vector<char> encode_events_elsewhere();